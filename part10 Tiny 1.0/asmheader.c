@@ -10,157 +10,588 @@
  *
  */
 
-#include <stdio.h>
+#include "output.h"
 #include "asmheader.h"
+#include "code.h"
+
+#define STR_(x) #x
+#define STR(x) STR_(x) //Expand a macro into a string literal
 
 //Reading http://zathras.de/angelweb/blog-intel-assembler-on-mac-os-x.htm helped me
 //get started in generating the skeleton code
 
-void asmheader() {
-	printf("#assemble/link with 'gcc file.s -o file\n");
-	printf("	.text\n");
-	printf(".globl _main\n");
-	printf("	.data\n");
-	printf("IOBUF: .space %d\n", IOBUFSIZE);
+static const char headerText[] =
+	"#assemble/link with 'gcc file.s -o file\n"
+	"	.text\n"
+	".globl _main\n"
+	"	.data\n"
+	"IOBUF: .space " STR(IOBUFSIZE) "\n"
+	"__outbuf: .space " STR(OUTBUFSIZE) "\n"
+	"__outlen: .long 0\n";
+
+//x86-64 Linux: the same routines with syscall, RIP-relative addressing and
+//  no stack arguments. They change only %rax, %rcx, %rdx, %rsi, %rdi and
+//  %r11 (which syscall destroys), so the other registers can hold variables.
+static const char headerText64[] =
+	"#assemble/link with 'gcc file.s -o file'\n"
+	"	.text\n"
+	".globl main\n"
+	"	.data\n"
+	"IOBUF: .space " STR(IOBUFSIZE) "\n"
+	"__outbuf: .space " STR(OUTBUFSIZE) "\n"
+	"__outlen: .long 0\n";
+
+void asmheader(Output *out, int target) {
+	outStr(out, TARGET_ELF64 == target ? headerText64 : headerText);
 }
 
-void asmprolog() {
-	printf("	.text\n");
-
-	printf("\n#convert eax to ascii in IOBUF and append newline\n");
-	printf("# RETURN: eax contains length of string (including newline)\n");
-	printf("_convertToAscii:\n");
-	printf("	push	%%ebp\n");
-	printf("	mov	%%esp, %%ebp\n");
-	printf("	\n");
-	printf("	#set ebx if eax is negative\n");
-	printf("	mov	$10, %%ecx	#Move 10 into ecx to use for dividing later\n");
-	printf("	mov $0, %%ebx\n");
-	printf("	cmp	$0, %%eax\n");
-	printf("	jge	__cta0\n");
-	printf("	mov $1, %%ebx\n");
-	printf("	neg	%%eax\n");
-	printf("__cta0:\n");
-	printf("	mov	$0,%%edx\n");
-	printf("	div	%%ecx	#divide edx:eax by 10. edx<-remainder, eax<-quotient\n");
-	printf("	add	$0x30,%%edx	#convert remainder to ASCII\n");
-	printf("	push	%%edx #push digit onto stack\n");
-	printf("	cmp	$0, %%eax\n");
-	printf("	jg	__cta0\n");
-	printf("	\n");
-	printf("	#value is converted and placed on stack with most significant digit on top\n");
-	printf("	lea	IOBUF, %%edi\n");
-	printf("	mov	$0, %%ecx\n");
-	printf("	test	%%ebx,%%ebx\n");
-	printf("	jz	__cta1\n");
-	printf("	movl	$0x2D, (%%edi,%%ecx) #'-' character\n");
-	printf("	inc	%%ecx\n");
-	printf("	\n");
-	printf("__cta1: #move encoded value from stack to buffer\n");
-	printf("	pop	%%eax\n");
-	printf("	mov	%%eax,(%%edi,%%ecx)\n");
-	printf("	inc	%%ecx\n");
-	printf("	cmp	%%ebp,%%esp\n");
-	printf("	jne	__cta1\n");
-	printf("	\n");
-	printf("	movl	$0x0A, (%%edi,%%ecx) #newline\n");
-	printf("	inc	%%ecx\n");
-	printf("	mov	%%ecx,%%eax\n");
-	printf("	leave\n");
-	printf("	ret\n\n");
-	
-	printf("# Convert ASCII value in IOBUF to decimal value\n");
-	printf("#  INPUT: eax = number of characters in IOBUF\n");
-	printf("#  RETURN: eax = converted value\n");
-	printf("#  locals:\n");
-	printf("#     -4(%%ebp): number of characters in IOBUF\n");
-	printf("#     -8(%%ebp): negative flag (non-zero if value is negative)\n");
-	printf("#    -12(%%ebp): decimal value 10 for multiplying eax\n");
-	printf("_convertFromAscii:\n");
-	printf("    push    %%ebp\n");
-	printf("    mov %%esp, %%ebp\n");
-	printf("    sub $24, %%esp\n");
-	printf("    mov %%eax, -4(%%ebp)   #move number of characters to -4(%%ebp)\n");
-	printf("    mov $0, %%eax    #initialize return value to zero\n");
-	printf("    mov %%eax, -8(%%ebp)   #clear negative flag\n");
-	printf("    cmpl    $0, -4(%%ebp)\n");
-	printf("    jle __cfa_exit #If zero characters read, stop now\n");
-	printf("    \n");
-	printf("    movl    $10, -12(%%ebp)\n");
-	printf("    lea IOBUF, %%esi\n");
-	printf("    mov $0, %%ecx    #initialize index register\n");
-	printf("    mov (%%esi, %%ecx), %%bl\n");
-	printf("    cmp $0x2D, %%bl	#test for minus sign\n");
-	printf("    jne __cfa_readLoop\n");
-	printf("    movl    $1, -8(%%ebp)	#set negative flag\n");
-	printf("    inc %%ecx\n");
-	printf("__cfa_readLoop:\n");
-	printf("    cmp -4(%%ebp), %%ecx\n");
-	printf("    jge __cfa_checkForNegative  #reached end of buffer\n");
-	printf("    mov (%%esi, %%ecx), %%bl  #move next byte to bl\n");
-	printf("    inc %%ecx    #advance index\n");
-	printf("    cmp $0x2C, %%bl  #compare to ascii comma\n");
-	printf("    je  __cfa_readLoop  #ignore commas\n");
-	printf("    sub $0x30, %%bl\n");
-	printf("    jl  __cfa_checkForNegative  #if ascii value less than 0x30 (ascii 0), we are finished\n");
-	printf("    cmp $9, %%bl\n");
-	printf("    jg  __cfa_checkForNegative  #if value>9, we are finished\n");
-	printf("    mull -12(%%ebp)  #multiply eax by 10\n");
-	printf("    movsx %%bl, %%ebx\n");
-	printf("    add %%ebx, %%eax  #add new digit to eax\n");
-	printf("    jmp __cfa_readLoop\n");
-	printf("    \n");
-	printf("__cfa_checkForNegative:\n");
-	printf("    cmpl    $0, -8(%%ebp)\n");
-	printf("    je  __cfa_exit\n");
-	printf("    neg %%eax\n");
-	printf("    \n");
-	printf("__cfa_exit:\n");
-	printf("    leave\n");
-	printf("    ret\n\n");	
-	
-	printf("# Write IOBUF to stdout\n");
-	printf("#  INPUT: eax = number of characters to write\n");
-	printf("#  RETURN: eax = number of characters written\n");
-	printf("_writeIobuf:\n");
-	printf("	push	%%ebp\n");
-	printf("	mov	%%esp, %%ebp\n");
-	printf("	push	%%eax	#length of string to write\n");
-	printf("	lea	IOBUF,%%eax\n");
-	printf("	push	%%eax	#buffer address\n");
-	printf("	pushl	$%d	#stdout\n", stdout_num);
-	printf("	mov	$%d, %%eax	#SYS_write\n", SYS_write);
-	printf("	push	%%eax\n");
-	printf("	int	$0x80\n");
-	printf("	leave\n");
-	printf("	ret\n\n");
-
-	printf("# Read stdin to IOBUF\n");
-	printf("#  RETURN: eax = number of characters received\n");
-	printf("_readIobuf:\n");
-	printf("	push	%%ebp\n");
-	printf("	mov	%%esp, %%ebp\n");
-	printf("	pushl	$%d	#buffer size\n", IOBUFSIZE);
-	printf("	lea	IOBUF,%%eax\n");
-	printf("	push	%%eax	#buffer address\n");
-	printf("	pushl	$%d	#stdin\n", stdin_num);
-	printf("	mov	$%d, %%eax	#SYS_write\n", SYS_read);
-	printf("	push	%%eax\n");
-	printf("	int	$0x80\n");
-	printf("	leave\n");
-	printf("	ret\n\n");
-	
-	printf("_main:\n");
-	printf("	push	%%ebp\n");
-	printf("	mov	%%esp, %%ebp\n");
-	printf("	mov	$0, %%eax\n");
-
-	printf("# program starts here\n");
+static const char prologText[] =
+	"	.text\n"
+
+	"\n#convert eax to ascii in IOBUF and append newline\n"
+	"# The digits are counted first, then written straight into IOBUF from the\n"
+	"# right, two at a time from a table, dividing by 100 with a multiply.\n"
+	"# RETURN: eax contains length of string (including newline)\n"
+	"# CHANGES: ecx, edx, esi and edi. -O keeps variables in esi and edi\n"
+	"# and saves them around WRITE, which this relies on.\n"
+	"_convertToAscii:\n"
+	"	lea	IOBUF, %edi\n"
+	"	test	%eax,%eax\n"
+	"	jns	__cta0\n"
+	"	movb	$0x2D,(%edi)	#'-' character\n"
+	"	inc	%edi\n"
+	"	neg	%eax\n"
+	"__cta0:	#count the digits: log10(2) for each bit, then one more if the value reaches the next power of ten\n"
+	"	mov	%eax,%ecx\n"
+	"	or	$1,%ecx	#0 has one digit too\n"
+	"	bsr	%ecx,%edx\n"
+	"	inc	%edx\n"
+	"	imul	$1233,%edx,%edx	#1233/4096 is just over log10(2)\n"
+	"	shr	$12,%edx\n"
+	"	cmp	__ctaPowers(,%edx,4),%ecx\n"
+	"	sbb	$-1,%edi\n"
+	"	add	%edx,%edi	#edi is past the last digit\n"
+	"	movb	$0x0A,(%edi)	#newline\n"
+	"	mov	%edi,%esi\n"
+	"	mov	%eax,%ecx\n"
+	"__cta1:\n"
+	"	cmp	$100,%ecx\n"
+	"	jb	__cta2\n"
+	"	mov	$0x51EB851F,%eax\n"
+	"	mul	%ecx	#edx<-quotient by 100 times 32: 0x51EB851F is 2^37/100\n"
+	"	shr	$5,%edx\n"
+	"	imul	$100,%edx,%eax\n"
+	"	sub	%eax,%ecx	#remainder\n"
+	"	movzwl	__ctaDigits(,%ecx,2),%eax\n"
+	"	sub	$2,%esi\n"
+	"	mov	%ax,(%esi)\n"
+	"	mov	%edx,%ecx\n"
+	"	jmp	__cta1\n"
+	"__cta2:	#one or two digits left\n"
+	"	cmp	$10,%ecx\n"
+	"	jb	__cta3\n"
+	"	movzwl	__ctaDigits(,%ecx,2),%eax\n"
+	"	mov	%ax,-2(%esi)\n"
+	"	jmp	__cta4\n"
+	"__cta3:\n"
+	"	add	$0x30,%ecx\n"
+	"	mov	%cl,-1(%esi)\n"
+	"__cta4:\n"
+	"	lea	1(%edi),%eax\n"
+	"	lea	IOBUF,%ecx\n"
+	"	sub	%ecx,%eax\n"
+	"	ret\n"
+	"__ctaDigits:\n"
+	"	.ascii	\"" DIGIT_PAIRS "\"\n"
+	"__ctaPowers:\n"
+	"	.long	" POWERS_OF_TEN "\n\n"
+
+	"# Convert ASCII value in IOBUF to decimal value\n"
+	"#  INPUT: eax = number of characters in IOBUF\n"
+	"#  RETURN: eax = converted value\n"
+	"#  locals:\n"
+	"#     -4(%ebp): number of characters in IOBUF\n"
+	"#     -8(%ebp): negative flag (non-zero if value is negative)\n"
+	"#    -12(%ebp): decimal value 10 for multiplying eax\n"
+	"_convertFromAscii:\n"
+	"    push    %ebp\n"
+	"    mov %esp, %ebp\n"
+	"    sub $24, %esp\n"
+	"    mov %eax, -4(%ebp)   #move number of characters to -4(%ebp)\n"
+	"    mov $0, %eax    #initialize return value to zero\n"
+	"    mov %eax, -8(%ebp)   #clear negative flag\n"
+	"    cmpl    $0, -4(%ebp)\n"
+	"    jle __cfa_exit #If zero characters read, stop now\n"
+	"    \n"
+	"    movl    $10, -12(%ebp)\n"
+	"    lea IOBUF, %esi\n"
+	"    mov $0, %ecx    #initialize index register\n"
+	"    mov (%esi, %ecx), %bl\n"
+	"    cmp $0x2D, %bl	#test for minus sign\n"
+	"    jne __cfa_readLoop\n"
+	"    movl    $1, -8(%ebp)	#set negative flag\n"
+	"    inc %ecx\n"
+	"__cfa_readLoop:\n"
+	"    cmp -4(%ebp), %ecx\n"
+	"    jge __cfa_checkForNegative  #reached end of buffer\n"
+	"    mov (%esi, %ecx), %bl  #move next byte to bl\n"
+	"    inc %ecx    #advance index\n"
+	"    cmp $0x2C, %bl  #compare to ascii comma\n"
+	"    je  __cfa_readLoop  #ignore commas\n"
+	"    sub $0x30, %bl\n"
+	"    jl  __cfa_checkForNegative  #if ascii value less than 0x30 (ascii 0), we are finished\n"
+	"    cmp $9, %bl\n"
+	"    jg  __cfa_checkForNegative  #if value>9, we are finished\n"
+	"    mull -12(%ebp)  #multiply eax by 10\n"
+	"    movsx %bl, %ebx\n"
+	"    add %ebx, %eax  #add new digit to eax\n"
+	"    jmp __cfa_readLoop\n"
+	"    \n"
+	"__cfa_checkForNegative:\n"
+	"    cmpl    $0, -8(%ebp)\n"
+	"    je  __cfa_exit\n"
+	"    neg %eax\n"
+	"    \n"
+	"__cfa_exit:\n"
+	"    leave\n"
+	"    ret\n\n"
+
+	"# Write IOBUF to stdout\n"
+	"# The characters are added to __outbuf, which is only written out when it\n"
+	"# is full, before a read and at the end of the program.\n"
+	"#  INPUT: eax = number of characters to write\n"
+	"#  RETURN: eax = number of characters written\n"
+	"_writeIobuf:\n"
+	"	push	%ebp\n"
+	"	mov	%esp, %ebp\n"
+	"	mov	__outlen, %edx\n"
+	"	lea	(%edx,%eax), %ecx\n"
+	"	cmp	$" STR(OUTBUFSIZE) ", %ecx\n"
+	"	jbe	__wio0\n"
+	"	push	%eax\n"
+	"	call	_flushOutput	#no room left\n"
+	"	pop	%eax\n"
+	"	xor	%edx, %edx\n"
+	"__wio0:\n"
+	"	lea	__outbuf(%edx), %edi\n"
+	"	lea	IOBUF, %esi\n"
+	"	mov	%eax, %ecx\n"
+	"	rep movsb\n"
+	"	add	%eax, __outlen\n"
+	"	leave\n"
+	"	ret\n\n"
+
+	"# Write __outbuf to stdout and empty it\n"
+	"_flushOutput:\n"
+	"	push	%ebp\n"
+	"	mov	%esp, %ebp\n"
+	"	mov	__outlen, %eax\n"
+	"	test	%eax, %eax\n"
+	"	jz	__flo0\n"
+	"	push	%eax	#length of string to write\n"
+	"	lea	__outbuf,%eax\n"
+	"	push	%eax	#buffer address\n"
+	"	pushl	$" STR(stdout_num) "	#stdout\n"
+	"	mov	$" STR(SYS_write) ", %eax	#SYS_write\n"
+	"	push	%eax\n"
+	"	int	$0x80\n"
+	"	movl	$0, __outlen\n"
+	"__flo0:\n"
+	"	leave\n"
+	"	ret\n\n"
+
+	"# Read stdin to IOBUF\n"
+	"# What has been written so far goes out first, so prompts appear.\n"
+	"#  RETURN: eax = number of characters received\n"
+	"_readIobuf:\n"
+	"	push	%ebp\n"
+	"	mov	%esp, %ebp\n"
+	"	call	_flushOutput\n"
+	"	pushl	$" STR(IOBUFSIZE) "	#buffer size\n"
+	"	lea	IOBUF,%eax\n"
+	"	push	%eax	#buffer address\n"
+	"	pushl	$" STR(stdin_num) "	#stdin\n"
+	"	mov	$" STR(SYS_read) ", %eax	#SYS_write\n"
+	"	push	%eax\n"
+	"	int	$0x80\n"
+	"	leave\n"
+	"	ret\n\n"
+
+	"_main:\n"
+	"	push	%ebp\n"
+	"	mov	%esp, %ebp\n"
+	"	mov	$0, %eax\n"
+
+	"# program starts here\n";
+
+static const char prologText64[] =
+	"	.text\n"
+
+	"\n#convert eax to ascii in IOBUF and append newline\n"
+	"# The same as the 32-bit routine, in 64-bit registers\n"
+	"# RETURN: eax contains length of string (including newline)\n"
+	"_convertToAscii:\n"
+	"	lea	IOBUF(%rip),%rdi\n"
+	"	test	%eax,%eax\n"
+	"	jns	__cta0\n"
+	"	movb	$0x2D,(%rdi)	#'-' character\n"
+	"	inc	%rdi\n"
+	"	neg	%eax\n"
+	"__cta0:	#count the digits\n"
+	"	mov	%eax,%eax	#clear the high half\n"
+	"	mov	%eax,%ecx\n"
+	"	or	$1,%ecx\n"
+	"	bsr	%ecx,%edx\n"
+	"	inc	%edx\n"
+	"	imul	$1233,%edx,%edx\n"
+	"	shr	$12,%edx\n"
+	"	lea	__ctaPowers(%rip),%r11\n"
+	"	cmp	(%r11,%rdx,4),%ecx\n"
+	"	sbb	$-1,%rdi\n"
+	"	add	%rdx,%rdi	#rdi is past the last digit\n"
+	"	movb	$0x0A,(%rdi)	#newline\n"
+	"	mov	%rdi,%rsi\n"
+	"	lea	__ctaDigits(%rip),%r11\n"
+	"__cta1:\n"
+	"	cmp	$100,%eax\n"
+	"	jb	__cta2\n"
+	"	imul	$0x51EB851F,%rax,%rdx\n"
+	"	shr	$37,%rdx	#quotient by 100\n"
+	"	imul	$100,%edx,%ecx\n"
+	"	sub	%ecx,%eax	#remainder\n"
+	"	movzwl	(%r11,%rax,2),%ecx\n"
+	"	sub	$2,%rsi\n"
+	"	mov	%cx,(%rsi)\n"
+	"	mov	%edx,%eax\n"
+	"	jmp	__cta1\n"
+	"__cta2:\n"
+	"	cmp	$10,%eax\n"
+	"	jb	__cta3\n"
+	"	movzwl	(%r11,%rax,2),%ecx\n"
+	"	mov	%cx,-2(%rsi)\n"
+	"	jmp	__cta4\n"
+	"__cta3:\n"
+	"	add	$0x30,%eax\n"
+	"	mov	%al,-1(%rsi)\n"
+	"__cta4:\n"
+	"	lea	1(%rdi),%rax\n"
+	"	lea	IOBUF(%rip),%rcx\n"
+	"	sub	%rcx,%rax\n"
+	"	ret\n"
+	"__ctaDigits:\n"
+	"	.ascii	\"" DIGIT_PAIRS "\"\n"
+	"__ctaPowers:\n"
+	"	.long	" POWERS_OF_TEN "\n\n"
+
+	"# Convert ASCII value in IOBUF to decimal value\n"
+	"#  INPUT: eax = number of characters in IOBUF\n"
+	"#  RETURN: eax = converted value\n"
+	"_convertFromAscii:\n"
+	"	lea	IOBUF(%rip),%rsi\n"
+	"	mov	%eax,%ecx	#characters left\n"
+	"	xor	%eax,%eax	#initialize return value to zero\n"
+	"	xor	%edi,%edi	#clear negative flag\n"
+	"	test	%ecx,%ecx\n"
+	"	jle	__cfa_exit	#If zero characters read, stop now\n"
+	"	cmpb	$0x2D,(%rsi)	#test for minus sign\n"
+	"	jne	__cfa_readLoop\n"
+	"	inc	%edi	#set negative flag\n"
+	"	inc	%rsi\n"
+	"	dec	%ecx\n"
+	"__cfa_readLoop:\n"
+	"	test	%ecx,%ecx\n"
+	"	jle	__cfa_checkForNegative	#reached end of buffer\n"
+	"	movzbl	(%rsi),%edx	#move next byte to edx\n"
+	"	inc	%rsi\n"
+	"	dec	%ecx\n"
+	"	cmp	$0x2C,%edx	#ignore commas\n"
+	"	je	__cfa_readLoop\n"
+	"	sub	$0x30,%edx\n"
+	"	jl	__cfa_checkForNegative	#less than ascii 0, we are finished\n"
+	"	cmp	$9,%edx\n"
+	"	jg	__cfa_checkForNegative	#more than 9, we are finished\n"
+	"	imul	$10,%eax\n"
+	"	add	%edx,%eax	#add new digit to eax\n"
+	"	jmp	__cfa_readLoop\n"
+	"__cfa_checkForNegative:\n"
+	"	test	%edi,%edi\n"
+	"	jz	__cfa_exit\n"
+	"	neg	%eax\n"
+	"__cfa_exit:\n"
+	"	ret\n\n"
+
+	"# Write IOBUF to stdout, by way of __outbuf\n"
+	"#  INPUT: eax = number of characters to write\n"
+	"#  RETURN: eax = number of characters written\n"
+	"_writeIobuf:\n"
+	"	mov	__outlen(%rip),%edx\n"
+	"	lea	(%rdx,%rax),%ecx\n"
+	"	cmp	$" STR(OUTBUFSIZE) ",%ecx\n"
+	"	jbe	__wio0\n"
+	"	push	%rax\n"
+	"	call	_flushOutput	#no room left\n"
+	"	pop	%rax\n"
+	"	xor	%edx,%edx\n"
+	"__wio0:\n"
+	"	lea	__outbuf(%rip),%rdi\n"
+	"	add	%rdx,%rdi\n"
+	"	lea	IOBUF(%rip),%rsi\n"
+	"	mov	%eax,%ecx\n"
+	"	rep movsb\n"
+	"	add	%eax,__outlen(%rip)\n"
+	"	ret\n\n"
+
+	"# Write __outbuf to stdout and empty it\n"
+	"_flushOutput:\n"
+	"	mov	__outlen(%rip),%edx\n"
+	"	test	%edx,%edx\n"
+	"	jz	__flo0\n"
+	"	lea	__outbuf(%rip),%rsi\n"
+	"	mov	$" STR(stdout_num) ",%edi\n"
+	"	mov	$" STR(SYS64_write) ",%eax\n"
+	"	syscall\n"
+	"	xor	%edx,%edx\n"
+	"	mov	%edx,__outlen(%rip)\n"
+	"__flo0:\n"
+	"	ret\n\n"
+
+	"# Read stdin to IOBUF, after writing out __outbuf\n"
+	"#  RETURN: eax = number of characters received\n"
+	"_readIobuf:\n"
+	"	call	_flushOutput\n"
+	"	mov	$" STR(IOBUFSIZE) ",%edx	#buffer size\n"
+	"	lea	IOBUF(%rip),%rsi\n"
+	"	mov	$" STR(stdin_num) ",%edi\n"
+	"	mov	$" STR(SYS64_read) ",%eax\n"
+	"	syscall\n"
+	"	ret\n\n"
+
+	"main:\n"
+	"	push	%rbp\n"
+	"	mov	%rsp,%rbp\n"
+	"	push	%rbx	#the program uses %ebx, which the caller expects back\n"
+	"	mov	$0,%eax\n"
+
+	"# program starts here\n";
+
+void asmprolog(Output *out, int target) {
+	outStr(out, TARGET_ELF64 == target ? prologText64 : prologText);
+}
+
+static const char epilogText[] =
+	"# contents of %eax will be the exit code\n"
+	"	push	%eax\n"
+	"	call	_flushOutput\n"
+	"	pop	%eax\n"
+	"	leave\n"
+	"	ret\n"
+	"	.subsections_via_symbols\n";
+
+static const char epilogText64[] =
+	"# contents of %eax will be the exit code\n"
+	"	push	%rax\n"
+	"	call	_flushOutput\n"
+	"	pop	%rax\n"
+	"	mov	-8(%rbp),%rbx\n"
+	"	leave\n"
+	"	ret\n"
+	"	.section .note.GNU-stack,\"\",@progbits\n";
+
+void asmepilog(Output *out, int target) {
+	outStr(out, TARGET_ELF64 == target ? epilogText64 : epilogText);
 }
 
-void asmepilog() {
-	printf("# contents of %%eax will be the exit code\n");
-	printf("	leave\n");
-	printf("	ret\n");
-	printf("	.subsections_via_symbols\n");
-}
\ No newline at end of file
+//The same x86-64 runtime as machine code, for the integrated assembler
+//  The instructions that find IOBUF, __outbuf and __outlen have their offsets
+//  left as zero; runtime64Data says where they are.
+#define B32(n) (n) & 0xff, (n) >> 8 & 0xff, (n) >> 16 & 0xff, (n) >> 24 & 0xff //A 32-bit value, little-endian
+#define PAIRS(t) '0' + (t), '0', '0' + (t), '1', '0' + (t), '2', '0' + (t), '3', '0' + (t), '4', \
+	'0' + (t), '5', '0' + (t), '6', '0' + (t), '7', '0' + (t), '8', '0' + (t), '9' //DIGIT_PAIRS from t0 to t9
+
+const unsigned char runtime64Code[runtime64Size] = {
+	//_convertToAscii:
+	0x48, 0x8d, 0x3d, B32(0), //lea IOBUF(%rip),%rdi
+	0x85, 0xc0, //test %eax,%eax
+	0x79, 0x08, //jns __cta0
+	0xc6, 0x07, 0x2d, //movb $0x2D,(%rdi)
+	0x48, 0xff, 0xc7, //inc %rdi
+	0xf7, 0xd8, //neg %eax
+	//__cta0:
+	0x89, 0xc0, //mov %eax,%eax
+	0x89, 0xc1, //mov %eax,%ecx
+	0x83, 0xc9, 0x01, //or $1,%ecx
+	0x0f, 0xbd, 0xd1, //bsr %ecx,%edx
+	0xff, 0xc2, //inc %edx
+	0x69, 0xd2, B32(1233), //imul $1233,%edx,%edx
+	0xc1, 0xea, 0x0c, //shr $12,%edx
+	0x4c, 0x8d, 0x1d, B32(0x12a), //lea __ctaPowers(%rip),%r11
+	0x41, 0x3b, 0x0c, 0x93, //cmp (%r11,%rdx,4),%ecx
+	0x48, 0x83, 0xdf, 0xff, //sbb $-1,%rdi
+	0x48, 0x01, 0xd7, //add %rdx,%rdi
+	0xc6, 0x07, 0x0a, //movb $0x0A,(%rdi)
+	0x48, 0x89, 0xfe, //mov %rdi,%rsi
+	0x4c, 0x8d, 0x1d, B32(0x4a), //lea __ctaDigits(%rip),%r11
+	//__cta1:
+	0x83, 0xf8, 0x64, //cmp $100,%eax
+	0x72, 0x20, //jb __cta2
+	0x48, 0x69, 0xd0, B32(0x51EB851F), //imul $0x51EB851F,%rax,%rdx
+	0x48, 0xc1, 0xea, 0x25, //shr $37,%rdx
+	0x6b, 0xca, 0x64, //imul $100,%edx,%ecx
+	0x29, 0xc8, //sub %ecx,%eax
+	0x41, 0x0f, 0xb7, 0x0c, 0x43, //movzwl (%r11,%rax,2),%ecx
+	0x48, 0x83, 0xee, 0x02, //sub $2,%rsi
+	0x66, 0x89, 0x0e, //mov %cx,(%rsi)
+	0x89, 0xd0, //mov %edx,%eax
+	0xeb, 0xdb, //jmp __cta1
+	//__cta2:
+	0x83, 0xf8, 0x0a, //cmp $10,%eax
+	0x72, 0x0b, //jb __cta3
+	0x41, 0x0f, 0xb7, 0x0c, 0x43, //movzwl (%r11,%rax,2),%ecx
+	0x66, 0x89, 0x4e, 0xfe, //mov %cx,-2(%rsi)
+	0xeb, 0x06, //jmp __cta4
+	//__cta3:
+	0x83, 0xc0, 0x30, //add $0x30,%eax
+	0x88, 0x46, 0xff, //mov %al,-1(%rsi)
+	//__cta4:
+	0x48, 0x8d, 0x47, 0x01, //lea 1(%rdi),%rax
+	0x48, 0x8d, 0x0d, B32(0), //lea IOBUF(%rip),%rcx
+	0x48, 0x29, 0xc8, //sub %rcx,%rax
+	0xc3, //ret
+	//__ctaDigits:
+	PAIRS(0), PAIRS(1), PAIRS(2), PAIRS(3), PAIRS(4), PAIRS(5), PAIRS(6), PAIRS(7), PAIRS(8), PAIRS(9),
+	//__ctaPowers:
+	B32(1), B32(10), B32(100), B32(1000), B32(10000), B32(100000), B32(1000000),
+	B32(10000000), B32(100000000), B32(1000000000),
+
+	//_convertFromAscii:
+	0x48, 0x8d, 0x35, B32(0), //lea IOBUF(%rip),%rsi
+	0x89, 0xc1, //mov %eax,%ecx
+	0x31, 0xc0, //xor %eax,%eax
+	0x31, 0xff, //xor %edi,%edi
+	0x85, 0xc9, //test %ecx,%ecx
+	0x7e, 0x34, //jle __cfa_exit
+	0x80, 0x3e, 0x2d, //cmpb $0x2D,(%rsi)
+	0x75, 0x07, //jne __cfa_readLoop
+	0xff, 0xc7, //inc %edi
+	0x48, 0xff, 0xc6, //inc %rsi
+	0xff, 0xc9, //dec %ecx
+	//__cfa_readLoop:
+	0x85, 0xc9, //test %ecx,%ecx
+	0x7e, 0x1e, //jle __cfa_checkForNegative
+	0x0f, 0xb6, 0x16, //movzbl (%rsi),%edx
+	0x48, 0xff, 0xc6, //inc %rsi
+	0xff, 0xc9, //dec %ecx
+	0x83, 0xfa, 0x2c, //cmp $0x2C,%edx
+	0x74, 0xef, //je __cfa_readLoop
+	0x83, 0xea, 0x30, //sub $0x30,%edx
+	0x7c, 0x0c, //jl __cfa_checkForNegative
+	0x83, 0xfa, 0x09, //cmp $9,%edx
+	0x7f, 0x07, //jg __cfa_checkForNegative
+	0x6b, 0xc0, 0x0a, //imul $10,%eax
+	0x01, 0xd0, //add %edx,%eax
+	0xeb, 0xde, //jmp __cfa_readLoop
+	//__cfa_checkForNegative:
+	0x85, 0xff, //test %edi,%edi
+	0x74, 0x02, //jz __cfa_exit
+	0xf7, 0xd8, //neg %eax
+	//__cfa_exit:
+	0xc3, //ret
+
+	//_writeIobuf:
+	0x8b, 0x15, B32(0), //mov __outlen(%rip),%edx
+	0x8d, 0x0c, 0x02, //lea (%rdx,%rax),%ecx
+	0x81, 0xf9, B32(OUTBUFSIZE), //cmp $OUTBUFSIZE,%ecx
+	0x76, 0x09, //jbe __wio0
+	0x50, //push %rax
+	0xe8, B32(0x1f), //call _flushOutput
+	0x58, //pop %rax
+	0x31, 0xd2, //xor %edx,%edx
+	//__wio0:
+	0x48, 0x8d, 0x3d, B32(0), //lea __outbuf(%rip),%rdi
+	0x48, 0x01, 0xd7, //add %rdx,%rdi
+	0x48, 0x8d, 0x35, B32(0), //lea IOBUF(%rip),%rsi
+	0x89, 0xc1, //mov %eax,%ecx
+	0xf3, 0xa4, //rep movsb
+	0x01, 0x05, B32(0), //add %eax,__outlen(%rip)
+	0xc3, //ret
+
+	//_flushOutput:
+	0x8b, 0x15, B32(0), //mov __outlen(%rip),%edx
+	0x85, 0xd2, //test %edx,%edx
+	0x74, 0x1b, //jz __flo0
+	0x48, 0x8d, 0x35, B32(0), //lea __outbuf(%rip),%rsi
+	0xbf, B32(stdout_num), //mov $stdout_num,%edi
+	0xb8, B32(SYS64_write), //mov $SYS64_write,%eax
+	0x0f, 0x05, //syscall
+	0x31, 0xd2, //xor %edx,%edx
+	0x89, 0x15, B32(0), //mov %edx,__outlen(%rip)
+	//__flo0:
+	0xc3, //ret
+
+	//_readIobuf:
+	0xe8, B32(-0x2b), //call _flushOutput
+	0xba, B32(IOBUFSIZE), //mov $IOBUFSIZE,%edx
+	0x48, 0x8d, 0x35, B32(0), //lea IOBUF(%rip),%rsi
+	0xbf, B32(stdin_num), //mov $stdin_num,%edi
+	0xb8, B32(SYS64_read), //mov $SYS64_read,%eax
+	0x0f, 0x05, //syscall
+	0xc3, //ret
+
+	//main:
+	0x55, //push %rbp
+	0x48, 0x89, 0xe5, //mov %rsp,%rbp
+	0x53, //push %rbx
+	0xb8, B32(0) //mov $0,%eax
+};
+
+const int runtime64Func[fnCount] = {0x000, 0x181, 0x1c7, 0x223, 0x1fd};
+
+const char *const runtime64Name[fnCount] = {
+	"_convertToAscii", "_convertFromAscii", "_writeIobuf", "_readIobuf", "_flushOutput"
+};
+
+const int runtime64Data[runtime64DataCount][2] = {
+	{0x003, 0}, {0x089, 0}, {0x184, 0}, {0x1c9, OUTLEN_AT}, {0x1e4, OUTBUF_AT}, {0x1ee, 0},
+	{0x1f8, OUTLEN_AT}, {0x1ff, OUTLEN_AT}, {0x20a, OUTBUF_AT}, {0x21e, OUTLEN_AT}, {0x230, 0}
+};
+
+const unsigned char epilog64Code[epilog64Size] = {
+	0x50, //push %rax
+	0xe8, B32(0), //call _flushOutput
+	0x58, //pop %rax
+	0x48, 0x8b, 0x5d, 0xf8, //mov -8(%rbp),%rbx
+	0xc9, //leave
+	0xc3 //ret
+};
+
+//Call to a runtime routine written in C, for --run
+//  C functions may change %r8 to %r11, which hold variables, and want the
+//  stack 16-byte aligned, which the program's pushes do not keep. %rbp is
+//  saved first because it may hold a variable too.
+const unsigned char helper64Code[helper64Size] = {
+	0x55, //push %rbp
+	0x48, 0x89, 0xe5, //mov %rsp,%rbp
+	0x48, 0x83, 0xe4, 0xf0, //and $-16,%rsp
+	0x41, 0x50, //push %r8
+	0x41, 0x51, //push %r9
+	0x41, 0x52, //push %r10
+	0x41, 0x53, //push %r11, to keep the alignment
+	0x89, 0xc7, //mov %eax,%edi
+	0x48, 0xb8, B32(0), B32(0), //movabs $routine,%rax
+	0xff, 0xd0, //call *%rax
+	0x41, 0x5b, //pop %r11
+	0x41, 0x5a, //pop %r10
+	0x41, 0x59, //pop %r9
+	0x41, 0x58, //pop %r8
+	0x48, 0x89, 0xec, //mov %rbp,%rsp
+	0x5d, //pop %rbp
+	0xc3 //ret
+};
+
+//Entry point of an executable with no C library: exit with main's result
+const unsigned char start64Code[start64Size] = {
+	0xe8, B32(0), //call main
+	0x89, 0xc7, //mov %eax,%edi
+	0xb8, B32(SYS64_exit), //mov $SYS64_exit,%eax
+	0x0f, 0x05 //syscall
+};
@@ -11,13 +11,54 @@
  */
 
 #define IOBUFSIZE 256
+#define OUTBUFSIZE 8192 //WRITE output waiting to go out
+
+//The runtime's data: IOBUF, __outbuf, then __outlen, the characters in __outbuf
+#define OUTBUF_AT IOBUFSIZE
+#define OUTLEN_AT (IOBUFSIZE + OUTBUFSIZE)
+#define RUNTIME_DATA_SIZE (OUTLEN_AT + 4)
+
 #define SYS_read 3
 #define SYS_write 4
 
+//Linux x86-64 system call numbers
+#define SYS64_read 0
+#define SYS64_write 1
+#define SYS64_exit 60
+
 #define stdin_num 0
 #define stdout_num 1
 #define stderr_num 2
 
-void asmheader();
-void asmprolog();
-void asmepilog();
\ No newline at end of file
+//Tables for _convertToAscii
+//  DIGIT_PAIRS holds the two digits of each number from 0 to 99.
+#define DIGIT_PAIRS \
+	"00010203040506070809" "10111213141516171819" "20212223242526272829" "30313233343536373839" \
+	"40414243444546474849" "50515253545556575859" "60616263646566676869" "70717273747576777879" \
+	"80818283848586878889" "90919293949596979899"
+#define POWERS_OF_TEN "1, 10, 100, 1000, 10000, 100000, 1000000, 10000000, 100000000, 1000000000"
+
+//target is TARGET_MACHO32 or TARGET_ELF64
+void asmheader(Output *out, int target);
+void asmprolog(Output *out, int target);
+void asmepilog(Output *out, int target);
+
+//The x86-64 runtime as machine code, for -f obj and -f exe
+//  runtime64Code holds the routines and the start of main.
+#define runtime64Size 0x24b
+#define runtime64Main 0x241 //Offset of main
+#define runtime64DataCount 11
+#define epilog64Size 13
+#define epilog64Call 2 //Offset of the call's 32-bit displacement
+#define start64Size 14
+#define start64Call 1 //Offset of the call's 32-bit displacement
+#define helper64Size 0x2b
+#define helper64Address 0x14 //Offset of the routine's 64-bit address
+
+extern const unsigned char runtime64Code[runtime64Size];
+extern const int runtime64Func[]; //Offset of each routine, by FN_...
+extern const char *const runtime64Name[];
+extern const int runtime64Data[runtime64DataCount][2]; //{offset of a RIP-relative field, offset in the data it points to}
+extern const unsigned char epilog64Code[epilog64Size];
+extern const unsigned char start64Code[start64Size];
+extern const unsigned char helper64Code[helper64Size];
\ No newline at end of file
@@ -0,0 +1,213 @@
+/*
+ *  ast.c
+ *  Lets's Build a Compiler
+ *  Syntax tree. With -O the parser builds a tree of the whole program
+ *  instead of generating code as it goes, so that later passes can look
+ *  at more than one statement at a time.
+ *
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include "ast.h"
+#include "code.h"
+
+//Allocate a node of the given kind with room for words words after its header
+//Returns its index
+int astNode(Ast *t, int kind, int op, int cond, int words) {
+	int n;
+	if (t->count + 1 + words > t->capacity) {
+		//Large arrays are grown by remapping, so doubling costs no copy
+		t->capacity = t->capacity ? 2 * t->capacity : 64 * 1024;
+		t->w = realloc(t->w, t->capacity * sizeof(int));
+		if (NULL == t->w)
+			abort();
+	}
+	if (0 == t->count)
+		t->count = 1; //Keep index 0 for "none"
+	n = t->count;
+	t->w[n] = kind | op << 8 | cond << 16;
+	t->count += 1 + words;
+	return n;
+}
+
+//Header for a number node holding value
+static int numHeader(int value) {
+	return N_NUM | 1 << astNeedShift | (0 == value || -1 == value ? AST_BOOL : 0);
+}
+
+//Make a number or variable node
+int astLeaf(Ast *t, int kind, int value) {
+	int n = astNode(t, kind, 0, 0, 1);
+	astArg(t, n, 0) = value;
+	if (N_NUM == kind)
+		t->w[n] = numHeader(value);
+	else
+		t->w[n] |= 1 << astNeedShift;
+	return n;
+}
+
+//Make a negation or NOT node
+int astUnary(Ast *t, int kind, int operand) {
+	int n = astNode(t, kind, 0, 0, 1);
+	astArg(t, n, 0) = operand;
+	if (N_NOT == kind)
+		t->w[n] |= astBool(t, operand);
+	t->w[n] |= astNeed(t, operand) << astNeedShift;
+	return n;
+}
+
+//Make a binary operator node
+int astBinary(Ast *t, int op, int cond, int left, int right) {
+	int n = astNode(t, N_BINARY, op, cond, 2);
+	int l = astNeed(t, left);
+	int r = astNeed(t, right);
+	int need;
+	astArg(t, n, 0) = left;
+	astArg(t, n, 1) = right;
+	if (NULL == strchr("|~&+-*/", op))
+		t->w[n] |= AST_BOOL; //A relation
+	else if (NULL != strchr("|~&", op))
+		t->w[n] |= astBool(t, left) & astBool(t, right);
+	if ('/' != op && (N_NUM == astKind(t, right) || N_VAR == astKind(t, right)))
+		r = 0;
+	need = l == r ? l + 1 : l > r ? l : r;
+	t->w[n] |= (need < astMaxNeed ? need : astMaxNeed) << astNeedShift;
+	return n;
+}
+
+//Make an assignment statement
+int astAssign(Ast *t, int id, int expr) {
+	int n = astNode(t, N_ASSIGN, 0, 0, 3);
+	astNext(t, n) = 0;
+	astArg(t, n, 1) = id;
+	astArg(t, n, 2) = expr;
+	return n;
+}
+
+//Make a statement reading one variable
+int astRead(Ast *t, int id) {
+	int n = astNode(t, N_READ, 0, 0, 2);
+	astNext(t, n) = 0;
+	astArg(t, n, 1) = id;
+	return n;
+}
+
+//Make a statement writing one expression
+int astWrite(Ast *t, int expr) {
+	int n = astNode(t, N_WRITE, 0, 0, 2);
+	astNext(t, n) = 0;
+	astArg(t, n, 1) = expr;
+	return n;
+}
+
+//Make an IF statement
+int astIf(Ast *t, int cond, int thenPart, int elsePart, int hasElse) {
+	int n = astNode(t, N_IF, hasElse, 0, 4);
+	astNext(t, n) = 0;
+	astArg(t, n, 1) = cond;
+	astArg(t, n, 2) = thenPart;
+	astArg(t, n, 3) = elsePart;
+	return n;
+}
+
+//Make a WHILE statement
+int astWhile(Ast *t, int cond, int body) {
+	int n = astNode(t, N_WHILE, 0, 0, 3);
+	astNext(t, n) = 0;
+	astArg(t, n, 1) = cond;
+	astArg(t, n, 2) = body;
+	return n;
+}
+
+//Evaluate a binary operator as the generated code would
+//  Arithmetic wraps at 32 bits and division is unsigned; relations give TRUE (-1) or FALSE (0)
+//  Returns 0 if the operation cannot be done at compile time
+static int evalBinary(int op, int cond, int a, int b, int *result) {
+	unsigned x = a;
+	unsigned y = b;
+	switch (op) {
+		case '|':
+			*result = x | y;
+			return 1;
+		case '~':
+			*result = x ^ y;
+			return 1;
+		case '&':
+			*result = x & y;
+			return 1;
+		case '+':
+			*result = x + y;
+			return 1;
+		case '-':
+			*result = x - y;
+			return 1;
+		case '*':
+			*result = x * y;
+			return 1;
+		case '/':
+			if (0 == y)
+				return 0; //Leave the division to fault at run time
+			*result = x / y;
+			return 1;
+	}
+	switch (cond) {
+		case CC_E:
+			*result = a == b ? -1 : 0;
+			return 1;
+		case CC_NE:
+			*result = a != b ? -1 : 0;
+			return 1;
+		case CC_L:
+			*result = a < b ? -1 : 0;
+			return 1;
+		case CC_GE:
+			*result = a >= b ? -1 : 0;
+			return 1;
+		case CC_LE:
+			*result = a <= b ? -1 : 0;
+			return 1;
+		case CC_G:
+			*result = a > b ? -1 : 0;
+			return 1;
+	}
+	return 0;
+}
+
+//Make a binary operator node, folding it to a number if both operands are numbers
+//  The operands are the last nodes built, so a folded result reuses the left one's words
+int astFoldBinary(Ast *t, int op, int cond, int left, int right) {
+	int value;
+	if (N_NUM == astKind(t, left) && N_NUM == astKind(t, right)
+		&& evalBinary(op, cond, astArg(t, left, 0), astArg(t, right, 0), &value)) {
+		if (left + 2 == right && right + 2 == t->count) {
+			t->w[left] = numHeader(value);
+			astArg(t, left, 0) = value;
+			t->count = right;
+			return left;
+		}
+		return astLeaf(t, N_NUM, value);
+	}
+	return astBinary(t, op, cond, left, right);
+}
+
+//Make a negation or NOT node, folding it to a number if the operand is a number
+int astFoldUnary(Ast *t, int kind, int operand) {
+	if (N_NUM == astKind(t, operand)) {
+		unsigned x = astArg(t, operand, 0);
+		int value = N_NEG == kind ? -x : ~x;
+		if (operand + 2 == t->count) {
+			t->w[operand] = numHeader(value);
+			astArg(t, operand, 0) = value;
+			return operand;
+		}
+		return astLeaf(t, N_NUM, value);
+	}
+	return astUnary(t, kind, operand);
+}
+
+//Free the whole tree
+void freeAst(Ast *t) {
+	free(t->w);
+	memset(t, 0, sizeof *t);
+}
@@ -0,0 +1,70 @@
+/*
+ *  ast.h
+ *  Lets's Build a Compiler
+ *  Syntax tree. With -O the parser builds a tree of the whole program
+ *  instead of generating code as it goes, so that later passes can look
+ *  at more than one statement at a time.
+ *
+ *  Nodes are variable-sized records in one growable array of 32-bit words
+ *  and refer to each other by word index, not by pointer. The whole tree
+ *  is freed at once. Index 0 is never a node and stands for "none".
+ *
+ */
+
+//Node kinds
+enum {
+	N_NUM = 1, N_VAR, N_NEG, N_NOT, N_BINARY,
+	N_ASSIGN, N_READ, N_WRITE, N_IF, N_WHILE
+};
+
+//Node layouts. Every node starts with a header word holding its kind,
+//  op and cond; the words listed here follow it.
+//  N_NUM     value
+//  N_VAR     symbol ID
+//  N_NEG     operand
+//  N_NOT     operand
+//  N_BINARY  left, right  (op is the operator token, cond the condition code of a relation)
+//  N_ASSIGN  next, symbol ID, expression
+//  N_READ    next, symbol ID
+//  N_WRITE   next, expression
+//  N_IF      next, condition, then, else  (op is 1 if there is an ELSE)
+//  N_WHILE   next, condition, body
+//Statements are chained through next; a block is its first statement.
+//A node whose value is always TRUE (-1) or FALSE (0) is flagged AST_BOOL
+//  in its header: relations, the numbers -1 and 0, and NOT, &, | and ~
+//  over such nodes.
+//The top bits of an expression's header hold its need: how many registers
+//  it takes to evaluate without spilling (its Sethi-Ullman number). A number
+//  or variable on the right of an operator other than / needs none, because
+//  it can be an instruction operand.
+
+typedef struct {
+	int *w;
+	int count; //Words in use
+	int capacity;
+} Ast;
+
+#define AST_BOOL (1 << 24)
+#define astNeedShift 25
+#define astMaxNeed 63
+
+#define astKind(t, n) ((t)->w[n] & 0xFF)
+#define astOp(t, n) (((t)->w[n] >> 8) & 0xFF)
+#define astCond(t, n) (((t)->w[n] >> 16) & 0xFF)
+#define astBool(t, n) ((t)->w[n] & AST_BOOL)
+#define astNeed(t, n) (((unsigned)(t)->w[n] >> astNeedShift) & astMaxNeed)
+#define astArg(t, n, i) ((t)->w[(n) + 1 + (i)])
+#define astNext(t, n) astArg(t, n, 0)
+
+int astNode(Ast *t, int kind, int op, int cond, int words);
+int astLeaf(Ast *t, int kind, int value);
+int astUnary(Ast *t, int kind, int operand);
+int astBinary(Ast *t, int op, int cond, int left, int right);
+int astAssign(Ast *t, int id, int expr);
+int astRead(Ast *t, int id);
+int astWrite(Ast *t, int expr);
+int astIf(Ast *t, int cond, int thenPart, int elsePart, int hasElse);
+int astWhile(Ast *t, int cond, int body);
+int astFoldBinary(Ast *t, int op, int cond, int left, int right);
+int astFoldUnary(Ast *t, int kind, int operand);
+void freeAst(Ast *t);
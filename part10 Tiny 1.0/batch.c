@@ -0,0 +1,167 @@
+/*
+ *  batch.c
+ *  Lets's Build a Compiler
+ *  Batch mode. Many source files are compiled in one process by a pool of
+ *  worker threads, each with its own Compiler. The files are dealt out to
+ *  the workers up front; a worker that runs out steals from another's queue,
+ *  so one slow file does not hold up the files queued behind it.
+ *
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+
+#include "input.h"
+#include "symtab.h"
+#include "output.h"
+#include "code.h"
+#include "lexer.h"
+#include "ast.h"
+#include "peep.h"
+#include "regalloc.h"
+#include "encode.h"
+#include "jit.h"
+#include "vm.h"
+#include "compiler.h"
+
+#define batchMaxThreads 64
+
+//A worker's queue: the files from top up to bottom
+//  The owner takes files from the bottom, thieves from the top.
+typedef struct {
+	pthread_mutex_t lock;
+	int top;
+	int bottom;
+} Deque;
+
+typedef struct {
+	const char *const *files;
+	Deque *deques;
+	int threads;
+	const Options *opt;
+	int failures;
+} Batch;
+
+typedef struct {
+	Batch *batch;
+	int id;
+	pthread_t thread;
+} Worker;
+
+//Take the next file from the worker's own queue
+//Returns its index, or -1 if the queue is empty
+static int popBottom(Deque *d) {
+	int i = -1;
+	pthread_mutex_lock(&d->lock);
+	if (d->top < d->bottom)
+		i = --d->bottom;
+	pthread_mutex_unlock(&d->lock);
+	return i;
+}
+
+//Take the oldest file from another worker's queue
+//Returns its index, or -1 if the queue is empty
+static int stealTop(Deque *d) {
+	int i = -1;
+	pthread_mutex_lock(&d->lock);
+	if (d->top < d->bottom)
+		i = d->top++;
+	pthread_mutex_unlock(&d->lock);
+	return i;
+}
+
+//Find work: first in our own queue, then in everyone else's
+//No files are added once the batch starts, so when every queue is empty we are done
+static int nextFile(Worker *w) {
+	Batch *b = w->batch;
+	int i = popBottom(&b->deques[w->id]);
+	int k;
+	for (k = 1; i < 0 && k < b->threads; k++)
+		i = stealTop(&b->deques[(w->id + k) % b->threads]);
+	return i;
+}
+
+//Name the output for a source file: name.tiny becomes name.s, name.o or name
+//  An executable from a file without .tiny gets .out, so the source is not overwritten
+//Returns a string the caller must free
+static char *outputName(const char *path, int format) {
+	static const char *const ext[] = {".s", ".o", ""};
+	const char *e = ext[format];
+	size_t len = strlen(path);
+	char *name = malloc(len + 5);
+	if (NULL == name)
+		abort();
+	if (len > 5 && 0 == strcmp(path + len - 5, ".tiny"))
+		len -= 5;
+	else if (FORMAT_EXE == format)
+		e = ".out";
+	memcpy(name, path, len);
+	strcpy(name + len, e);
+	return name;
+}
+
+//Thread body: compile files until there are none left
+static void *batchWorker(void *arg) {
+	Worker *w = arg;
+	Batch *b = w->batch;
+	Compiler *c = calloc(1, sizeof(Compiler));
+	int i;
+
+	if (NULL == c)
+		abort();
+	c->opt = *b->opt;
+	c->opt.lexThreads = 1; //The workers already keep the processors busy
+	while ((i = nextFile(w)) >= 0) {
+		char *outPath = outputName(b->files[i], c->opt.format);
+		c->name = b->files[i];
+		if (0 != compile(c, b->files[i], outPath))
+			__sync_fetch_and_add(&b->failures, 1);
+		free(outPath);
+	}
+	free(c);
+	return NULL;
+}
+
+//Compile every file in files[] on up to threads threads
+//Returns the number of files that failed to compile
+int runBatch(int fileCount, const char *const files[], int threads, const Options *opt) {
+	Batch b;
+	Worker *workers;
+	int i;
+
+	if (threads > batchMaxThreads)
+		threads = batchMaxThreads;
+	if (threads > fileCount)
+		threads = fileCount;
+	b.files = files;
+	b.threads = threads;
+	b.opt = opt;
+	b.failures = 0;
+	b.deques = calloc(threads, sizeof(Deque));
+	workers = calloc(threads, sizeof(Worker));
+	if (NULL == b.deques || NULL == workers)
+		abort();
+	//Deal out the files in contiguous runs, one run per worker
+	for (i = 0; i < threads; i++) {
+		pthread_mutex_init(&b.deques[i].lock, NULL);
+		b.deques[i].top = (long)fileCount * i / threads;
+		b.deques[i].bottom = (long)fileCount * (i + 1) / threads;
+		workers[i].batch = &b;
+		workers[i].id = i;
+	}
+	for (i = 1; i < threads; i++) {
+		if (0 != pthread_create(&workers[i].thread, NULL, batchWorker, &workers[i]))
+			abort();
+	}
+	batchWorker(&workers[0]); //The calling thread is a worker too
+	for (i = 1; i < threads; i++)
+		pthread_join(workers[i].thread, NULL);
+
+	for (i = 0; i < threads; i++)
+		pthread_mutex_destroy(&b.deques[i].lock);
+	free(b.deques);
+	free(workers);
+	return b.failures;
+}
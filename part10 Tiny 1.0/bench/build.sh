@@ -0,0 +1,22 @@
+#!/bin/bash
+# build.sh: build a RELEASE compiler from any revision, to benchmark against
+#   bench/build.sh <revision> <output>
+# The revision is anything git names (a commit, HEAD~3, ...), or "." for
+# the working tree. The sources before the first benchmarked change call
+# BSD strlcpy, which older C libraries lack, so it is mapped to snprintf.
+# MAXSYMBOLS=n raises the old fixed symbol table limit, for symbols.sh.
+set -e
+here=$(cd "$(dirname "$0")/.." && pwd)
+rev=$1
+out=$(cd "$(dirname "$2")" && pwd)/$(basename "$2")
+tmp=$(mktemp -d)
+trap 'rm -rf "$tmp"' EXIT
+if [ "." = "$rev" ]; then
+	cp "$here"/*.c "$here"/*.h "$tmp"
+else
+	git -C "$here" archive "$rev" . | tar -x -C "$tmp"
+fi
+if [ -n "$MAXSYMBOLS" ]; then
+	sed -i.orig "s/^#define maxSymbols [0-9]*/#define maxSymbols $MAXSYMBOLS/" "$tmp"/main.c
+fi
+cc -std=gnu99 -O2 -w -DRELEASE '-Dstrlcpy(d,s,n)=snprintf(d,n,"%s",s)' -o "$out" "$tmp"/*.c -lpthread
@@ -0,0 +1,88 @@
+/*
+ *  cta.c
+ *  Lets's Build a Compiler
+ *  Benchmark for number formatting. Checks a _convertToAscii against
+ *  printf, then times it on 100M random numbers and 100M numbers below
+ *  1000. Built with -DASM it calls the x86-64 assembly routine that
+ *  cta.sh takes from a compiler's output; otherwise it calls
+ *  rtConvertToAscii from runtime.c.
+ *
+ *  cc -O2 -mno-red-zone -DASM -o cta bench/cta.c cta.s
+ *  cc -O2 -o cta bench/cta.c runtime.c
+ *
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include "../runtime.h"
+
+#define count 100000000L //Numbers to format in each timing
+
+#ifdef ASM
+extern char IOBUF[];
+
+//Call the routine the way generated code does, with the number in %eax
+static inline int convert(int n) {
+	int len;
+	__asm__ volatile ("call _convertToAscii" : "=a"(len) : "a"(n) : "rcx", "rdx", "rsi", "rdi", "r11", "memory", "cc");
+	return len;
+}
+
+//Check the string in the buffer
+static int check(int n, const char *want, int len) {
+	(void)n;
+	return len == (int)strlen(want) && 0 == memcmp(IOBUF, want, len);
+}
+#else
+#define convert rtConvertToAscii
+
+//The C runtime's buffer is its own, so read the number back from it
+static int check(int n, const char *want, int len) {
+	return len == (int)strlen(want) && n == rtConvertFromAscii(len - 1);
+}
+#endif
+
+static double now(void) {
+	struct timespec t;
+	clock_gettime(CLOCK_MONOTONIC, &t);
+	return t.tv_sec + t.tv_nsec * 1e-9;
+}
+
+int main(void) {
+	static const int edges[] = {0, 1, -1, 9, 10, -10, 99, 100, -100, 999, 1000, 12345, -99999,
+		999999999, 1000000000, -1000000000, 2147483647, -2147483647 - 1};
+	char want[16];
+	unsigned x = 1, sum = 0;
+	double start;
+	long i;
+	int n;
+
+	//Every edge case, then 20M random numbers of every length
+	for (i = 0; i < (long)(sizeof edges / sizeof edges[0]) + 20000000; i++) {
+		if (i < (long)(sizeof edges / sizeof edges[0]))
+			n = edges[i];
+		else {
+			x = x * 1103515245u + 12345u;
+			n = (int)x >> (x & 31);
+		}
+		sprintf(want, "%d\n", n);
+		if (!check(n, want, convert(n))) {
+			printf("wrong for %d\n", n);
+			return 1;
+		}
+	}
+
+	x = 1;
+	start = now();
+	for (i = 0; i < count; i++) {
+		x = x * 1103515245u + 12345u;
+		sum += convert((int)x);
+	}
+	printf("random  %6.2f ns per number\n", (now() - start) / count * 1e9);
+	start = now();
+	for (i = 0; i < count; i++)
+		sum += convert((int)(i % 1000));
+	printf("0..999  %6.2f ns per number\n", (now() - start) / count * 1e9);
+	return 0 == sum; //Keep the calls
+}
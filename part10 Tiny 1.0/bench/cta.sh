@@ -0,0 +1,26 @@
+#!/bin/bash
+# cta.sh: time the number formatting routine of each compiler, and of runtime.c
+#   bench/cta.sh compiler ...
+# Takes _convertToAscii from each compiler's x86-64 output and runs cta.c
+# on it. The routine before "[user-024]" divides once per digit; build it
+# with bench/build.sh <revision> old. runtime.c is the working tree's.
+# Each run checks 20M numbers against printf and formats 200M.
+set -e
+bench=$(cd "$(dirname "$0")" && pwd)
+tmp=$(mktemp -d)
+trap 'rm -rf "$tmp"' EXIT
+printf 'PROGRAM\nBEGIN\nEND.\n' > "$tmp/empty.tiny"
+
+for tiny in "$@"; do
+	{
+		printf '\t.data\nIOBUF:\t.space 256\n\t.text\n.globl _convertToAscii, IOBUF\n'
+		"$tiny" -t elf64 "$tmp/empty.tiny" | sed -n '/^_convertToAscii:/,/^# Convert ASCII/p'
+		printf '\t.section .note.GNU-stack,"",@progbits\n'
+	} > "$tmp/cta.s"
+	cc -std=gnu99 -O2 -mno-red-zone -DASM -o "$tmp/cta" "$bench/cta.c" "$tmp/cta.s"
+	echo "$tiny:"
+	"$tmp/cta"
+done
+cc -std=gnu99 -O2 -o "$tmp/cta" "$bench/cta.c" "$bench/../runtime.c"
+echo "runtime.c:"
+"$tmp/cta"
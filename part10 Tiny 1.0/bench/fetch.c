@@ -0,0 +1,61 @@
+/*
+ *  fetch.c
+ *  Lets's Build a Compiler
+ *  Benchmark for the source input layer. Fetches every character of a
+ *  program, the way getChar() used to with getchar(), ferror() and feof(),
+ *  and the way the scanner does now, by walking a pointer over a Source.
+ *
+ *  cc -O2 -o fetch bench/fetch.c input.c
+ *  fetch getchar < prog.tiny
+ *  fetch source prog.tiny    (the file is mapped)
+ *  cat prog.tiny | fetch source    (block reads from a pipe)
+ *
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include "../input.h"
+
+static double now(void) {
+	struct timespec t;
+	clock_gettime(CLOCK_MONOTONIC, &t);
+	return t.tv_sec + t.tv_nsec * 1e-9;
+}
+
+int main(int argc, const char *argv[]) {
+	Source src;
+	unsigned long count = 0, sum = 0;
+	double start;
+	int c;
+
+	if (argc < 2 || (strcmp(argv[1], "getchar") && strcmp(argv[1], "source"))) {
+		fprintf(stderr, "usage: fetch getchar|source [file]\n");
+		return 2;
+	}
+	start = now();
+	if (0 == strcmp(argv[1], "getchar")) {
+		//As getChar() did before the input layer
+		for (;;) {
+			c = getchar();
+			if (ferror(stdin) || feof(stdin))
+				break;
+			sum += c;
+			count++;
+		}
+	} else {
+		//Includes mapping or reading the file, as the compiler pays for that too
+		if (0 != openSource(&src, argc > 2 ? argv[2] : NULL)) {
+			perror("fetch");
+			return 1;
+		}
+		while (src.ptr < src.end) {
+			sum += (unsigned char)*src.ptr++;
+			count++;
+		}
+		closeSource(&src);
+	}
+	printf("%-8s %8.0f MB/s  (%lu bytes, checksum %lu)\n", argv[1],
+		count / (now() - start) / (1024 * 1024), count, sum);
+	return 0;
+}
@@ -0,0 +1,30 @@
+# gendeep.awk: write a Tiny program with expressions nested n levels deep
+#   awk -v n=1000000 -f bench/gendeep.awk > deep.tiny
+# The three assignments nest n parentheses, n negations, (-(-(... A))),
+# and n additions, (A+(A+(... 1))).
+BEGIN {
+	if (!n) n = 1000000
+	print "PROGRAM"
+	print "VAR A"
+	print "BEGIN"
+	printf "A = "
+	for (i = 0; i < n; i++)
+		printf "("
+	printf "A"
+	for (i = 0; i < n; i++)
+		printf ")"
+	printf "\nA = "
+	for (i = 0; i < n; i++)
+		printf "(-"
+	printf "A"
+	for (i = 0; i < n; i++)
+		printf ")"
+	printf "\nA = "
+	for (i = 0; i < n; i++)
+		printf "(A+"
+	printf "1"
+	for (i = 0; i < n; i++)
+		printf ")"
+	print ""
+	print "END."
+}
@@ -0,0 +1,15 @@
+# genexpr.awk: write a Tiny program of n assignments with long expressions
+#   awk -v n=1500000 -f bench/genexpr.awk > expr.tiny
+# Every line uses each level of the precedence table once, so the time
+# goes to the expression parser rather than to statements.
+function v() { return substr("ABCD", 1 + int(rand() * 4), 1) }
+BEGIN {
+	if (!n) n = 1500000
+	srand(1)
+	print "PROGRAM"
+	print "VAR A, B, C, D"
+	print "BEGIN"
+	for (i = 0; i < n; i++)
+		print v() " = (" v() " + " v() " * 3 - " v() " / 2 < " v() " & !" v() " = " v() " | " v() " > 5) + " v()
+	print "END."
+}
@@ -0,0 +1,34 @@
+# genprog.awk: write a synthetic Tiny program of about mb megabytes
+#   awk -v mb=100 -v vars=100 -f bench/genprog.awk > prog.tiny
+# The statements are assignments, IFs and WHILEs over vars variables,
+# chosen at random with a fixed seed, so every run writes the same file.
+function v() { return "V" int(rand() * vars) }
+BEGIN {
+	if (!mb) mb = 100
+	if (!vars) vars = 100
+	srand(1)
+	print "PROGRAM"
+	for (i = 0; i < vars; i += 10) {
+		line = "VAR V" i
+		for (j = i + 1; j < i + 10 && j < vars; j++)
+			line = line ", V" j
+		print line
+	}
+	print "BEGIN"
+	for (n = 0; n < mb * 1024 * 1024; n += length(s) + 1) {
+		k = 1 + int(rand() * 999)
+		r = int(rand() * 4)
+		if (0 == r)
+			s = v() " = " v() " + " v() " * " k " - (" v() " / 2)"
+		else if (1 == r) {
+			a = v()
+			s = "IF " a " < " v() " & " v() " <> 0\n  " v() " = " a " - " k "\nENDIF"
+		} else if (2 == r) {
+			a = v()
+			s = "WHILE " a " > " k "\n  " a " = " a " - 1\nENDWHILE"
+		} else
+			s = v() " = -" v() " * 3 + " k " * 1024 + 16"
+		print s
+	}
+	print "END."
+}
@@ -0,0 +1,14 @@
+# gensyms.awk: write a Tiny program with n variables
+#   awk -v n=100000 -f bench/gensyms.awk > syms.tiny
+# n variables are declared, then there are n assignments, each reading
+# two variables picked at random from a fixed seed.
+BEGIN {
+	srand(1)
+	print "PROGRAM"
+	for (i = 0; i < n; i++)
+		print "VAR X" i
+	print "BEGIN"
+	for (i = 0; i < n; i++)
+		print "X" i " = X" int(rand() * n) " + X" int(rand() * n)
+	print "END."
+}
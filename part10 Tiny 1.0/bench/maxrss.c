@@ -0,0 +1,50 @@
+/*
+ *  maxrss.c
+ *  Lets's Build a Compiler
+ *  Benchmark helper. Runs a command with its output thrown away and
+ *  prints the peak resident memory it used, in kilobytes, like the
+ *  maximum resident set size from time -v.
+ *
+ *  cc -O2 -o maxrss bench/maxrss.c
+ *  maxrss tiny -O prog.tiny
+ *
+ */
+
+#include <stdio.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+
+int main(int argc, char *argv[]) {
+	struct rusage usage;
+	pid_t pid;
+	int status, null;
+
+	if (argc < 2) {
+		fprintf(stderr, "usage: maxrss command [argument ...]\n");
+		return 2;
+	}
+	pid = fork();
+	if (pid < 0) {
+		perror("fork");
+		return 2;
+	}
+	if (0 == pid) {
+		null = open("/dev/null", O_WRONLY);
+		dup2(null, 1);
+		execvp(argv[1], argv + 1);
+		perror(argv[1]);
+		_exit(127);
+	}
+	if (wait4(pid, &status, 0, &usage) < 0) {
+		perror("wait4");
+		return 2;
+	}
+#ifdef __APPLE__
+	//Darwin gives bytes, Linux kilobytes
+	usage.ru_maxrss /= 1024;
+#endif
+	printf("%ld\n", (long)usage.ru_maxrss);
+	return WIFEXITED(status) ? WEXITSTATUS(status) : 128 + WTERMSIG(status);
+}
@@ -0,0 +1,27 @@
+#!/bin/bash
+# memory.sh: peak memory per source line, with and without the syntax tree
+#   bench/memory.sh [mb] compiler ...
+# Writes an mb-megabyte mixed program (185 by default, about 10,000,000
+# lines) with genprog.awk and reports each compiler's peak RSS, in the
+# default mode and with -O, which builds the tree.
+set -e
+bench=$(cd "$(dirname "$0")" && pwd)
+mb=185
+if [[ "$1" =~ ^[0-9]+$ ]]; then
+	mb=$1
+	shift
+fi
+tmp=$(mktemp -d)
+trap 'rm -rf "$tmp"' EXIT
+
+awk -v mb="$mb" -v vars=100 -f "$bench/genprog.awk" > "$tmp/prog.tiny"
+lines=$(wc -l < "$tmp/prog.tiny")
+echo "program: $lines lines, $(wc -c < "$tmp/prog.tiny") bytes"
+cc -std=gnu99 -O2 -o "$tmp/maxrss" "$bench/maxrss.c"
+
+for tiny in "$@"; do
+	for opt in "" -O; do
+		kb=$("$tmp/maxrss" "$tiny" $opt "$tmp/prog.tiny")
+		awk -v kb="$kb" -v l="$lines" -v n="$tiny $opt" 'BEGIN { printf "%8.0f MB  %6.1f bytes/line  (%s)\n", kb / 1024, kb * 1024 / l, n }'
+	done
+done
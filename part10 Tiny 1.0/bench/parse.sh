@@ -0,0 +1,42 @@
+#!/bin/bash
+# parse.sh: compile time on deeply nested and expression-heavy programs
+#   bench/parse.sh [levels] compiler ...
+# The recursive descent parser is the revision before "[user-011]"; build
+# it with bench/build.sh <revision> old. A compiler that dies on a signal,
+# as the descent parser does when the C stack runs out, or that reports an
+# error, is shown as such.
+set -e
+bench=$(cd "$(dirname "$0")" && pwd)
+levels=1000000
+if [[ "$1" =~ ^[0-9]+$ ]]; then
+	levels=$1
+	shift
+fi
+tmp=$(mktemp -d)
+trap 'rm -rf "$tmp"' EXIT
+TIMEFORMAT=%R
+awk -v n=$levels -f "$bench/gendeep.awk" > "$tmp/deep.tiny"
+awk -f "$bench/genexpr.awk" > "$tmp/expr.tiny"
+
+printf "%-10s" ""
+for tiny in "$@"; do
+	printf "  %12s" "$(basename "$tiny")"
+done
+echo
+for prog in deep expr; do
+	printf "%-10s" $prog
+	for tiny in "$@"; do
+		set +e
+		t=$( { time "$tiny" "$tmp/$prog.tiny" > /dev/null 2>&1; } 2>&1 )
+		status=$?
+		set -e
+		if [ $status -gt 128 ]; then
+			printf "  %12s" "signal $((status - 128))"
+		elif [ $status -ne 0 ]; then
+			printf "  %12s" error
+		else
+			printf "  %10.3f s" "$t"
+		fi
+	done
+	echo
+done
@@ -0,0 +1,28 @@
+#!/bin/bash
+# read.sh: MB/s of the source reader
+#   bench/read.sh [mb] [compiler ...]
+# Writes an mb-megabyte program (100 by default) with genprog.awk, times
+# the character fetch loops in fetch.c, then times a whole compile with
+# each compiler given. bench/build.sh builds a compiler from an older
+# revision, to compare before and after.
+set -e
+bench=$(cd "$(dirname "$0")" && pwd)
+mb=${1:-100}
+shift || true
+tmp=$(mktemp -d)
+trap 'rm -rf "$tmp"' EXIT
+TIMEFORMAT=%R
+
+awk -v mb="$mb" -v vars=100 -f "$bench/genprog.awk" > "$tmp/prog.tiny"
+size=$(wc -c < "$tmp/prog.tiny")
+echo "program: $size bytes"
+
+cc -std=gnu99 -O2 -o "$tmp/fetch" "$bench/fetch.c" "$bench/../input.c"
+"$tmp/fetch" getchar < "$tmp/prog.tiny"
+"$tmp/fetch" source "$tmp/prog.tiny"
+cat "$tmp/prog.tiny" | "$tmp/fetch" source
+
+for tiny in "$@"; do
+	t=$( { time "$tiny" < "$tmp/prog.tiny" > /dev/null; } 2>&1 )
+	awk -v t="$t" -v s="$size" -v n="$tiny" 'BEGIN { printf "compile  %8.1f MB/s  (%s s, %s)\n", s / t / 1048576, t, n }'
+done
@@ -0,0 +1,41 @@
+#!/bin/bash
+# symbols.sh: compile time against the number of symbols
+#   bench/symbols.sh [max] compiler ...
+# Times each compiler on gensyms.awk programs with 100, 1000, ... up to
+# max variables (1000000 by default). A compiler whose run passes 300 s is
+# not timed on the larger sizes. The linear table before the hash table
+# held 100 symbols; build that revision with, for example,
+#   MAXSYMBOLS=2000000 bench/build.sh <revision> old
+set -e
+bench=$(cd "$(dirname "$0")" && pwd)
+max=1000000
+if [[ "$1" =~ ^[0-9]+$ ]]; then
+	max=$1
+	shift
+fi
+tmp=$(mktemp -d)
+trap 'rm -rf "$tmp"' EXIT
+TIMEFORMAT=%R
+
+printf "%10s" N
+for tiny in "$@"; do
+	printf "  %12s" "$(basename "$tiny")"
+done
+echo
+declare -A slow
+for ((n = 100; n <= max; n *= 10)); do
+	awk -v n=$n -f "$bench/gensyms.awk" > "$tmp/syms.tiny"
+	printf "%10d" $n
+	for tiny in "$@"; do
+		if [ -n "${slow[$tiny]}" ]; then
+			printf "  %12s" -
+			continue
+		fi
+		t=$( { time "$tiny" < "$tmp/syms.tiny" > /dev/null; } 2>&1 )
+		printf "  %10.3f s" "$t"
+		if awk -v t="$t" 'BEGIN { exit !(t > 300) }'; then
+			slow[$tiny]=1
+		fi
+	done
+	echo
+done
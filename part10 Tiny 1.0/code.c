@@ -0,0 +1,190 @@
+/*
+ *  code.c
+ *  Lets's Build a Compiler
+ *  Instruction stream. The code generation routines append compact
+ *  {opcode, operands} records here instead of formatting text; a single
+ *  printer turns them into assembly. Passes that work on generated code
+ *  see the records, not strings.
+ *
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include "code.h"
+#include "symtab.h"
+#include "output.h"
+
+const Operand none = {O_NONE, 0};
+
+static const char *const opName[opCount] = {
+	"mov", "movsx", "add", "sub", "and", "or", "xor", "cmp", "test",
+	"not", "neg", "mul", "imul", "div", "shr", "xchg", "push", "pop",
+	"set", "jmp", "j", "call",
+	NULL, NULL
+};
+
+static const char *const ccName[16] = {
+	"o", "no", "b", "ae", "e", "ne", "be", "a",
+	"s", "ns", "p", "np", "l", "ge", "le", "g"
+};
+
+static const char *const regName[16] = {
+	"%eax", "%ecx", "%edx", "%ebx", "%esp", "%ebp", "%esi", "%edi",
+	"%r8d", "%r9d", "%r10d", "%r11d", "%r12d", "%r13d", "%r14d", "%r15d"
+};
+
+static const char *const reg8Name[16] = {
+	"%al", "%cl", "%dl", "%bl", "%spl", "%bpl", "%sil", "%dil",
+	"%r8b", "%r9b", "%r10b", "%r11b", "%r12b", "%r13b", "%r14b", "%r15b"
+};
+
+//x86-64 pushes and pops whole 64-bit registers
+static const char *const reg64Name[16] = {
+	"%rax", "%rcx", "%rdx", "%rbx", "%rsp", "%rbp", "%rsi", "%rdi",
+	"%r8", "%r9", "%r10", "%r11", "%r12", "%r13", "%r14", "%r15"
+};
+
+static const char *const funcName[] = {
+	"_convertToAscii", "_convertFromAscii", "_writeIobuf", "_readIobuf", "_flushOutput"
+};
+
+static const char *const noteText[] = {
+	"#IF", "#ELSE", "#ENDIF", "#WHILE", "#ENDWHILE"
+};
+
+//Append an instruction
+void gen(Code *code, int op, Operand src, Operand dst) {
+	Instr *in;
+	if (code->count == code->capacity) {
+		code->capacity = code->capacity ? 2 * code->capacity : 4096;
+		code->instr = realloc(code->instr, code->capacity * sizeof(Instr));
+		if (NULL == code->instr)
+			abort();
+	}
+	in = &code->instr[code->count++];
+	in->op = op;
+	in->cond = 0;
+	in->srcKind = src.kind;
+	in->dstKind = dst.kind;
+	in->src = src.value;
+	in->dst = dst.value;
+}
+
+//Append a conditional instruction (OP_SET or OP_JCC)
+void genCond(Code *code, int op, int cond, Operand src) {
+	gen(code, op, src, none);
+	code->instr[code->count - 1].cond = cond;
+}
+
+//Append a decimal number
+static void outInt(Output *out, int n) {
+	char buf[12];
+	char *p = buf + sizeof buf;
+	unsigned u = n < 0 ? -(unsigned)n : (unsigned)n;
+	do {
+		*--p = '0' + u % 10;
+		u /= 10;
+	} while (u);
+	if (n < 0)
+		*--p = '-';
+	outBytes(out, p, buf + sizeof buf - p);
+}
+
+//Append a label name: L followed by at least five digits
+static void outLabel(Output *out, int id) {
+	char buf[12];
+	char *p = buf + sizeof buf;
+	unsigned u = id;
+	do {
+		*--p = '0' + u % 10;
+		u /= 10;
+	} while (u || p > buf + sizeof buf - 5);
+	*--p = 'L';
+	outBytes(out, p, buf + sizeof buf - p);
+}
+
+//Append one operand
+static void outOperand(Output *out, const SymbolTable *syms, int target, int kind, int value) {
+	switch (kind) {
+		case O_REG:
+			outBytes(out, regName[value], value < R_R10 ? 4 : 5);
+			break;
+		case O_REG8:
+			outStr(out, reg8Name[value]);
+			break;
+		case O_IMM:
+			outChar(out, '$');
+			outInt(out, value);
+			break;
+		case O_VAR:
+			outBytes(out, syms->table[value].name, syms->table[value].len);
+			if (TARGET_ELF64 == target)
+				outBytes(out, "(%rip)", 6); //Position independent
+			break;
+		case O_LABEL:
+			outLabel(out, value);
+			break;
+		case O_FUNC:
+			outStr(out, funcName[value]);
+			break;
+		case O_NOTE:
+			outStr(out, noteText[value]);
+			break;
+	}
+}
+
+//Print one instruction as a line of assembly
+static void printInstr(Output *out, const SymbolTable *syms, int target, const Instr *in) {
+	switch (in->op) {
+		case OP_LABEL:
+			outLabel(out, in->src);
+			outChar(out, ':');
+			if (O_NONE != in->dstKind) {
+				outChar(out, '\t');
+				outOperand(out, syms, target, in->dstKind, in->dst);
+			}
+			outChar(out, '\n');
+			return;
+		case OP_COMMENT:
+			outChar(out, '\t');
+			outOperand(out, syms, target, in->srcKind, in->src);
+			outChar(out, '\n');
+			return;
+	}
+	outChar(out, '\t');
+	outStr(out, opName[in->op]);
+	if (OP_SET == in->op || OP_JCC == in->op)
+		outStr(out, ccName[in->cond]);
+	if (TARGET_ELF64 == target && (OP_PUSH == in->op || OP_POP == in->op)) {
+		outChar(out, '\t');
+		outStr(out, reg64Name[in->src]);
+	}
+	else if (O_NONE != in->srcKind) {
+		outChar(out, '\t');
+		outOperand(out, syms, target, in->srcKind, in->src);
+	}
+	if (O_NONE != in->dstKind) {
+		outChar(out, ',');
+		outOperand(out, syms, target, in->dstKind, in->dst);
+	}
+	//TRUE is -1 in this language, so set results are widened by hand
+	if (OP_NEG == in->op && O_REG8 == in->srcKind)
+		outStr(out, "\t#change 1 to -1");
+	else if (OP_MOVSX == in->op)
+		outStr(out, "\t#extend al to eax");
+	outChar(out, '\n');
+}
+
+//Print the instruction stream and empty it
+void printCode(Code *code, const SymbolTable *syms, Output *out) {
+	int i;
+	for (i = 0; i < code->count; i++)
+		printInstr(out, syms, code->target, &code->instr[i]);
+	code->count = 0;
+}
+
+//Release the instruction stream
+void freeCode(Code *code) {
+	free(code->instr);
+	memset(code, 0, sizeof *code);
+}
@@ -0,0 +1,95 @@
+/*
+ *  code.h
+ *  Lets's Build a Compiler
+ *  Instruction stream. The code generation routines append compact
+ *  {opcode, operands} records here instead of formatting text; a single
+ *  printer turns them into assembly. Passes that work on generated code
+ *  see the records, not strings.
+ *
+ */
+
+//Opcodes
+enum {
+	OP_MOV, OP_MOVSX, OP_ADD, OP_SUB, OP_AND, OP_OR, OP_XOR, OP_CMP, OP_TEST,
+	OP_NOT, OP_NEG, OP_MUL, OP_IMUL, OP_DIV, OP_SHR, OP_XCHG, OP_PUSH, OP_POP,
+	OP_SET, OP_JMP, OP_JCC, OP_CALL,
+	OP_LABEL, OP_COMMENT,
+	opCount
+};
+
+//Registers, numbered as in the x86 instruction encoding
+//  R_R8 to R_R15 exist only on x86-64
+enum { R_AX, R_CX, R_DX, R_BX, R_SP, R_BP, R_SI, R_DI, R_R8, R_R9, R_R10, R_R11, R_R12, R_R13, R_R14, R_R15 };
+
+//Targets
+enum {
+	TARGET_MACHO32, //32-bit Mach-O for OS X, the default
+	TARGET_ELF64 //x86-64 System V ELF for Linux
+};
+
+//Condition codes for OP_SET and OP_JCC, numbered as in the x86 encoding
+enum {
+	CC_O, CC_NO, CC_B, CC_AE, CC_E, CC_NE, CC_BE, CC_A,
+	CC_S, CC_NS, CC_P, CC_NP, CC_L, CC_GE, CC_LE, CC_G
+};
+
+//Operand kinds
+enum {
+	O_NONE,
+	O_REG, //32-bit register
+	O_REG8, //Low byte of a register
+	O_IMM, //Immediate value
+	O_VAR, //Variable, by symbol ID
+	O_LABEL, //Label ID
+	O_FUNC, //Runtime routine (FN_...)
+	O_NOTE //Comment (NOTE_...)
+};
+
+//Runtime routines
+enum { FN_CONVERTTOASCII, FN_CONVERTFROMASCII, FN_WRITEIOBUF, FN_READIOBUF, FN_FLUSHOUTPUT, fnCount };
+
+//Comments attached to labels and control structures
+enum { NOTE_IF, NOTE_ELSE, NOTE_ENDIF, NOTE_WHILE, NOTE_ENDWHILE };
+
+typedef struct {
+	int kind;
+	int value; //Register, immediate, symbol ID, label ID, routine or note
+} Operand;
+
+//An instruction. Operands are in AT&T order: src, then dst.
+//  Single-operand instructions use src only.
+typedef struct {
+	unsigned char op;
+	unsigned char cond; //Condition code for OP_SET and OP_JCC
+	unsigned char srcKind;
+	unsigned char dstKind;
+	int src;
+	int dst;
+} Instr;
+
+#define codeFlushCount (64 * 1024) //Instructions to collect before printing at a statement boundary
+
+typedef struct {
+	Instr *instr;
+	int count;
+	int capacity;
+	int target; //TARGET_..., which decides how instructions are spelled
+} Code;
+
+extern const Operand none;
+
+static inline Operand reg(int r) { Operand o = {O_REG, r}; return o; }
+static inline Operand reg8(int r) { Operand o = {O_REG8, r}; return o; }
+static inline Operand imm(int n) { Operand o = {O_IMM, n}; return o; }
+static inline Operand var(int id) { Operand o = {O_VAR, id}; return o; }
+static inline Operand label(int id) { Operand o = {O_LABEL, id}; return o; }
+static inline Operand func(int fn) { Operand o = {O_FUNC, fn}; return o; }
+static inline Operand note(int n) { Operand o = {O_NOTE, n}; return o; }
+
+struct SymbolTable;
+struct Output;
+
+void gen(Code *code, int op, Operand src, Operand dst);
+void genCond(Code *code, int op, int cond, Operand src);
+void printCode(Code *code, const struct SymbolTable *syms, struct Output *out);
+void freeCode(Code *code);
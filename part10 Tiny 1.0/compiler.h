@@ -0,0 +1,74 @@
+/*
+ *  compiler.h
+ *  Lets's Build a Compiler
+ *  Compiler context. Everything one compilation needs lives in a Compiler,
+ *  which is passed to every parsing routine, so several compilations can
+ *  run in one process at the same time.
+ *
+ */
+
+#include <setjmp.h>
+
+#define exprRegMax 16 //Most registers an expression can have for temporaries
+
+//An operator waiting for its right operand
+typedef struct {
+	char op; //Operator token, '!' for NOT, '(' for an open parenthesis
+	char prec;
+	char cond; //Condition code for a relation
+	char neg; //For '(': negate the value when it closes
+} PendingOp;
+
+//Settings that apply to every file in a run
+typedef struct {
+	int lexThreads; //Threads to lex with, if the source is big enough
+	int optimize; //-O: build a syntax tree and generate code from it
+	int verbose; //-v: report what the optimizer did
+	int target; //-t: TARGET_MACHO32 or TARGET_ELF64
+	int format; //-f: FORMAT_ASM, FORMAT_OBJ or FORMAT_EXE; --run: FORMAT_RUN; --vm: FORMAT_VM
+	int tiered; //--tiered: FORMAT_VM, with hot loops compiled to machine code
+} Options;
+
+//A loop compiled to machine code by --tiered
+typedef struct {
+	JitCode code; //Not loaded yet if code.entry is NULL
+	unsigned char *vars; //The variables in its data, by symbol ID
+} TierLoop;
+
+typedef struct {
+	Source src;
+	SymbolTable syms;
+	TokenVec toks;
+	Code code;
+	Output out;
+	Ast ast;
+	RegAlloc ra;
+	Object obj; //Machine code, for -f obj and -f exe
+	Vm vm; //Bytecode, for --vm
+	TierLoop *tier; //Each VM_LOOP's machine code, for --tiered
+
+	int look; //Kind of the current token
+	int tokenPos; //Index of the current token
+	char token; //Current token type
+	const char *value; //Current token string
+	int valueId; //Symbol ID of the current token
+	int labelCount;
+	PendingOp *ops; //Expression parser's operator stack
+	int opCount;
+	int opCapacity;
+	int *vals; //Tree nodes of finished operands, and the tree walker's stack
+	int valCount;
+	int valCapacity;
+	int regPool[exprRegMax]; //Registers for expression temporaries in the current statement
+	int regPoolSize;
+	long peepApplied[peepRuleCount]; //Times each peephole rule was applied
+
+	Options opt;
+	const char *name; //Prefix for error messages, or NULL
+	jmp_buf failed; //fail() returns here
+	int status; //What the program returned, with --run or --vm
+} Compiler;
+
+int compile(Compiler *c, const char *srcPath, const char *outPath);
+
+int runBatch(int fileCount, const char *const files[], int threads, const Options *opt);
@@ -0,0 +1,242 @@
+/*
+ *  elf.c
+ *  Lets's Build a Compiler
+ *  ELF file writer. Wraps the machine code and data the integrated
+ *  assembler made in a relocatable object or a static executable.
+ *
+ *  An object has the sections an assembler would make: .text, .data, the
+ *  relocations for the RIP-relative references from .text to .data, and
+ *  a symbol table with main, the runtime routines and the variables.
+ *  An executable needs none of that: two program headers map the text
+ *  and the data, and the references are filled in directly. Its entry
+ *  point calls main and exits with what main returns.
+ *
+ *  The fields are written out one by one, little-endian, so this does not
+ *  depend on the host having <elf.h>.
+ *
+ */
+
+#include <string.h>
+#include "output.h"
+#include "symtab.h"
+#include "code.h"
+#include "asmheader.h"
+#include "encode.h"
+#include "elf.h"
+
+#define ehdrSize 64
+#define phdrSize 56
+#define shdrSize 64
+#define symSize 24
+#define relaSize 24
+
+enum { ET_REL = 1, ET_EXEC = 2 };
+enum { EM_X86_64 = 62 };
+enum { SHT_PROGBITS = 1, SHT_SYMTAB = 2, SHT_STRTAB = 3, SHT_RELA = 4 };
+enum { SHF_WRITE = 1, SHF_ALLOC = 2, SHF_EXECINSTR = 4, SHF_INFO_LINK = 0x40 };
+enum { STB_LOCAL = 0, STB_GLOBAL = 1 };
+enum { STT_OBJECT = 1, STT_FUNC = 2, STT_SECTION = 3 };
+enum { PT_LOAD = 1 };
+enum { PF_X = 1, PF_W = 2, PF_R = 4 };
+enum { R_X86_64_PC32 = 2 };
+
+//Sections of an object, in order
+enum { SEC_NULL, SEC_TEXT, SEC_DATA, SEC_RELA, SEC_SYMTAB, SEC_STRTAB, SEC_SHSTRTAB, SEC_NOTE, secCount };
+
+static const char *const secName[secCount] = {
+	"", ".text", ".data", ".rela.text", ".symtab", ".strtab", ".shstrtab", ".note.GNU-stack"
+};
+
+//Append a little-endian value of size bytes
+static void outLE(Output *out, unsigned long long n, int size) {
+	char b[8];
+	int i;
+	for (i = 0; i < size; i++)
+		b[i] = n >> 8 * i & 0xff;
+	outBytes(out, b, size);
+}
+
+static void outZeros(Output *out, long n) {
+	while (n-- > 0)
+		outChar(out, 0);
+}
+
+static long align(long n, long to) {
+	return (n + to - 1) & -to;
+}
+
+static void outEhdr(Output *out, int type, long entry, int phnum, long shoff, int shnum) {
+	outBytes(out, "\177ELF\2\1\1", 7); //64-bit, little-endian, version 1
+	outZeros(out, 9);
+	outLE(out, type, 2);
+	outLE(out, EM_X86_64, 2);
+	outLE(out, 1, 4);
+	outLE(out, entry, 8);
+	outLE(out, phnum ? ehdrSize : 0, 8);
+	outLE(out, shoff, 8);
+	outLE(out, 0, 4);
+	outLE(out, ehdrSize, 2);
+	outLE(out, phnum ? phdrSize : 0, 2);
+	outLE(out, phnum, 2);
+	outLE(out, shnum ? shdrSize : 0, 2);
+	outLE(out, shnum, 2);
+	outLE(out, shnum ? SEC_SHSTRTAB : 0, 2);
+}
+
+static void outPhdr(Output *out, int flags, long offset, long address, long size) {
+	outLE(out, PT_LOAD, 4);
+	outLE(out, flags, 4);
+	outLE(out, offset, 8);
+	outLE(out, address, 8);
+	outLE(out, address, 8);
+	outLE(out, size, 8);
+	outLE(out, size, 8);
+	outLE(out, 0x1000, 8);
+}
+
+static void outShdr(Output *out, int name, int type, int flags, long offset, long size, int link, int info, int align, int entsize) {
+	outLE(out, name, 4);
+	outLE(out, type, 4);
+	outLE(out, flags, 8);
+	outLE(out, 0, 8);
+	outLE(out, offset, 8);
+	outLE(out, size, 8);
+	outLE(out, link, 4);
+	outLE(out, info, 4);
+	outLE(out, align, 8);
+	outLE(out, entsize, 8);
+}
+
+static void outSym(Output *out, int name, int bind, int type, int section, long value, long size) {
+	outLE(out, name, 4);
+	outLE(out, bind << 4 | type, 1);
+	outLE(out, 0, 1);
+	outLE(out, section, 2);
+	outLE(out, value, 8);
+	outLE(out, size, 8);
+}
+
+//Write a static executable
+static void writeExe(Object *o, Output *out) {
+	long textOffset = ehdrSize + 2 * phdrSize;
+	long dataOffset = align(textOffset + o->text.count, 16);
+	long textAddress = elfTextAddress + textOffset;
+	long dataAddress = elfDataAddress + dataOffset; //Same offset in a page as in the file, as mmap needs
+
+	objPlace(o, textAddress, dataAddress);
+	outEhdr(out, ET_EXEC, textAddress, 2, 0, 0);
+	outPhdr(out, PF_R | PF_X, 0, elfTextAddress, textOffset + o->text.count);
+	outPhdr(out, PF_R | PF_W, dataOffset, dataAddress, o->data.count);
+	outBytes(out, (const char *)o->text.b, o->text.count);
+	outZeros(out, dataOffset - textOffset - o->text.count);
+	outBytes(out, (const char *)o->data.b, o->data.count);
+}
+
+//Write a relocatable object
+static void writeObj(Object *o, const SymbolTable *syms, Output *out) {
+	long offset[secCount], size[secCount];
+	int shname[secCount];
+	int relocs = 0, symbols, locals, strSize, i, name;
+
+	for (i = 0; i < o->fixCount; i++)
+		relocs += FIX_DATA == o->fix[i].kind;
+	//Symbols: null, .text, .data, the runtime's data and routines, the variables, then main, the only global
+	locals = 6 + fnCount;
+	strSize = 1 + strlen("IOBUF") + 1 + strlen("__outbuf") + 1 + strlen("__outlen") + 1 + strlen("main") + 1;
+	for (i = 0; i < fnCount; i++)
+		strSize += strlen(runtime64Name[i]) + 1;
+	for (i = 0; i < o->varCapacity; i++) {
+		if (o->varAt[i] >= 0) {
+			locals++;
+			strSize += syms->table[i].len + 1;
+		}
+	}
+	symbols = locals + 1;
+
+	size[SEC_NULL] = 0;
+	size[SEC_TEXT] = o->text.count;
+	size[SEC_DATA] = o->data.count;
+	size[SEC_RELA] = (long)relocs * relaSize;
+	size[SEC_SYMTAB] = (long)symbols * symSize;
+	size[SEC_STRTAB] = strSize;
+	size[SEC_SHSTRTAB] = 0;
+	size[SEC_NOTE] = 0;
+	for (i = 0; i < secCount; i++) {
+		shname[i] = size[SEC_SHSTRTAB];
+		size[SEC_SHSTRTAB] += strlen(secName[i]) + 1;
+	}
+	//Each section starts 16-byte aligned; the empty note's offset is where the section headers go
+	offset[SEC_NULL] = 0;
+	offset[SEC_TEXT] = ehdrSize;
+	for (i = SEC_DATA; i < secCount; i++)
+		offset[i] = align(offset[i - 1] + size[i - 1], 16);
+
+	outEhdr(out, ET_REL, 0, 0, offset[SEC_NOTE], secCount);
+	outZeros(out, offset[SEC_TEXT] - ehdrSize);
+	outBytes(out, (const char *)o->text.b, o->text.count);
+	outZeros(out, offset[SEC_DATA] - offset[SEC_TEXT] - size[SEC_TEXT]);
+	outBytes(out, (const char *)o->data.b, o->data.count);
+	outZeros(out, offset[SEC_RELA] - offset[SEC_DATA] - size[SEC_DATA]);
+	for (i = 0; i < o->fixCount; i++) {
+		if (FIX_DATA != o->fix[i].kind)
+			continue;
+		outLE(out, o->fix[i].at, 8);
+		outLE(out, (unsigned long long)SEC_DATA << 32 | R_X86_64_PC32, 8); //Symbol 2 is .data
+		outLE(out, o->fix[i].target - 4 - o->fix[i].tail, 8);
+	}
+	outZeros(out, offset[SEC_SYMTAB] - offset[SEC_RELA] - size[SEC_RELA]);
+	outSym(out, 0, 0, 0, 0, 0, 0);
+	outSym(out, 0, STB_LOCAL, STT_SECTION, SEC_TEXT, 0, 0);
+	outSym(out, 0, STB_LOCAL, STT_SECTION, SEC_DATA, 0, 0);
+	name = 1;
+	outSym(out, name, STB_LOCAL, STT_OBJECT, SEC_DATA, 0, IOBUFSIZE);
+	name += strlen("IOBUF") + 1;
+	outSym(out, name, STB_LOCAL, STT_OBJECT, SEC_DATA, OUTBUF_AT, OUTBUFSIZE);
+	name += strlen("__outbuf") + 1;
+	outSym(out, name, STB_LOCAL, STT_OBJECT, SEC_DATA, OUTLEN_AT, 4);
+	name += strlen("__outlen") + 1;
+	for (i = 0; i < fnCount; i++) {
+		outSym(out, name, STB_LOCAL, STT_FUNC, SEC_TEXT, o->funcAt[i], 0);
+		name += strlen(runtime64Name[i]) + 1;
+	}
+	for (i = 0; i < o->varCapacity; i++) {
+		if (o->varAt[i] >= 0) {
+			outSym(out, name, STB_LOCAL, STT_OBJECT, SEC_DATA, o->varAt[i], 4);
+			name += syms->table[i].len + 1;
+		}
+	}
+	outSym(out, name, STB_GLOBAL, STT_FUNC, SEC_TEXT, o->mainAt, 0);
+	outZeros(out, offset[SEC_STRTAB] - offset[SEC_SYMTAB] - size[SEC_SYMTAB]);
+	outChar(out, 0);
+	outBytes(out, "IOBUF", strlen("IOBUF") + 1);
+	outBytes(out, "__outbuf", strlen("__outbuf") + 1);
+	outBytes(out, "__outlen", strlen("__outlen") + 1);
+	for (i = 0; i < fnCount; i++)
+		outBytes(out, runtime64Name[i], strlen(runtime64Name[i]) + 1);
+	for (i = 0; i < o->varCapacity; i++) {
+		if (o->varAt[i] >= 0)
+			outBytes(out, syms->table[i].name, syms->table[i].len + 1);
+	}
+	outBytes(out, "main", strlen("main") + 1);
+	outZeros(out, offset[SEC_SHSTRTAB] - offset[SEC_STRTAB] - size[SEC_STRTAB]);
+	for (i = 0; i < secCount; i++)
+		outBytes(out, secName[i], strlen(secName[i]) + 1);
+	outZeros(out, offset[SEC_NOTE] - offset[SEC_SHSTRTAB] - size[SEC_SHSTRTAB]);
+
+	outShdr(out, 0, 0, 0, 0, 0, 0, 0, 0, 0);
+	outShdr(out, shname[SEC_TEXT], SHT_PROGBITS, SHF_ALLOC | SHF_EXECINSTR, offset[SEC_TEXT], size[SEC_TEXT], 0, 0, 16, 0);
+	outShdr(out, shname[SEC_DATA], SHT_PROGBITS, SHF_ALLOC | SHF_WRITE, offset[SEC_DATA], size[SEC_DATA], 0, 0, 16, 0);
+	outShdr(out, shname[SEC_RELA], SHT_RELA, SHF_INFO_LINK, offset[SEC_RELA], size[SEC_RELA], SEC_SYMTAB, SEC_TEXT, 8, relaSize);
+	outShdr(out, shname[SEC_SYMTAB], SHT_SYMTAB, 0, offset[SEC_SYMTAB], size[SEC_SYMTAB], SEC_STRTAB, locals, 8, symSize);
+	outShdr(out, shname[SEC_STRTAB], SHT_STRTAB, 0, offset[SEC_STRTAB], size[SEC_STRTAB], 0, 0, 1, 0);
+	outShdr(out, shname[SEC_SHSTRTAB], SHT_STRTAB, 0, offset[SEC_SHSTRTAB], size[SEC_SHSTRTAB], 0, 0, 1, 0);
+	outShdr(out, shname[SEC_NOTE], SHT_PROGBITS, 0, offset[SEC_NOTE], 0, 0, 0, 1, 0);
+}
+
+//Write the object or executable
+void writeElf(Object *o, const SymbolTable *syms, Output *out) {
+	if (FORMAT_EXE == o->format)
+		writeExe(o, out);
+	else
+		writeObj(o, syms, out);
+}
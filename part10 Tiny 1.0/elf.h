@@ -0,0 +1,15 @@
+/*
+ *  elf.h
+ *  Lets's Build a Compiler
+ *  ELF file writer. Wraps the machine code and data the integrated
+ *  assembler made in a relocatable object or a static executable.
+ *
+ */
+
+#define elfTextAddress 0x400000 //Where an executable's headers and text are loaded
+#define elfDataAddress 0x600000 //Where its data goes, give or take the file offset
+
+struct SymbolTable;
+struct Output;
+
+void writeElf(Object *o, const struct SymbolTable *syms, struct Output *out);
@@ -0,0 +1,396 @@
+/*
+ *  encode.c
+ *  Lets's Build a Compiler
+ *  Integrated assembler. Turns the instruction stream straight into x86-64
+ *  machine code, so an object file or executable can be written without
+ *  running an assembler.
+ *
+ *  Instructions are encoded as they are flushed, the same way the printer
+ *  would have spelled them. Jumps are the exception: how big a jump is
+ *  depends on how far away its label is, which is not known until the end.
+ *  So the text is kept without its jumps, and each jump and label records
+ *  where it falls in it. objEnd then makes every jump 2 bytes, grows the
+ *  ones whose labels are out of reach of an 8-bit displacement to 5 or 6,
+ *  and repeats, since growing one jump can push another out of reach.
+ *  Sizes only ever grow, so this stops.
+ *
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include "output.h"
+#include "code.h"
+#include "asmheader.h"
+#include "encode.h"
+
+//Make room for count more elements in an array
+static void *grow(void *p, int *capacity, int count, size_t size) {
+	if (count <= *capacity)
+		return p;
+	while (*capacity < count)
+		*capacity = *capacity ? 2 * *capacity : 1024;
+	p = realloc(p, *capacity * size);
+	if (NULL == p)
+		abort();
+	return p;
+}
+
+static void put(Bytes *b, int byte) {
+	b->b = grow(b->b, &b->capacity, b->count + 1, 1);
+	b->b[b->count++] = byte;
+}
+
+//Store a 32-bit value, little-endian
+static void set32(unsigned char *p, int n) {
+	p[0] = n & 0xff;
+	p[1] = n >> 8 & 0xff;
+	p[2] = n >> 16 & 0xff;
+	p[3] = n >> 24 & 0xff;
+}
+
+static void put32(Bytes *b, int n) {
+	b->b = grow(b->b, &b->capacity, b->count + 4, 1);
+	set32(b->b + b->count, n);
+	b->count += 4;
+}
+
+static void putBytes(Bytes *b, const unsigned char *s, int len) {
+	b->b = grow(b->b, &b->capacity, b->count + len, 1);
+	memcpy(b->b + b->count, s, len);
+	b->count += len;
+}
+
+//Note a 32-bit PC-relative field at offset at in the text, to fill in later
+static void fixupAt(Object *o, int at, int kind, int target, int tail) {
+	Fixup *f;
+	o->fix = grow(o->fix, &o->fixCapacity, o->fixCount + 1, sizeof(Fixup));
+	f = &o->fix[o->fixCount++];
+	f->at = at;
+	f->jumps = o->jumpCount;
+	f->kind = kind;
+	f->target = target;
+	f->tail = tail;
+}
+
+//Leave a 32-bit PC-relative field to fill in later
+static void fixup(Object *o, int kind, int target, int tail) {
+	fixupAt(o, o->text.count, kind, target, tail);
+	put32(&o->text, 0);
+}
+
+static int isByte(int n) {
+	return n >= -128 && n <= 127;
+}
+
+//Start an object: the runtime's buffers go first in the data
+void objStart(Object *o, int format) {
+	int i;
+	memset(o, 0, sizeof *o);
+	o->format = format;
+	for (i = 0; i < RUNTIME_DATA_SIZE; i++)
+		put(&o->data, 0);
+}
+
+//Lay down the runtime routines and the start of main
+//  helper is NULL, or the addresses of C functions to call instead of the
+//  runtime routines when the code is run in memory
+void objProlog(Object *o, void *const helper[fnCount]) {
+	int at, i;
+	unsigned long long address;
+	if (NULL != helper) {
+		for (i = 0; i < fnCount; i++) {
+			o->funcAt[i] = o->text.count;
+			putBytes(&o->text, helper64Code, helper64Size);
+			address = (unsigned long long)helper[i];
+			set32(o->text.b + o->funcAt[i] + helper64Address, address);
+			set32(o->text.b + o->funcAt[i] + helper64Address + 4, address >> 32);
+		}
+		//Just the start of main
+		o->mainAt = o->text.count;
+		putBytes(&o->text, runtime64Code + runtime64Main, runtime64Size - runtime64Main);
+		return;
+	}
+	if (FORMAT_EXE == o->format) {
+		putBytes(&o->text, start64Code, start64Size);
+		fixupAt(o, start64Call, FIX_CALL, start64Size + runtime64Main, 0);
+	}
+	at = o->text.count;
+	for (i = 0; i < fnCount; i++)
+		o->funcAt[i] = at + runtime64Func[i];
+	o->mainAt = at + runtime64Main;
+	putBytes(&o->text, runtime64Code, runtime64Size);
+	for (i = 0; i < runtime64DataCount; i++)
+		fixupAt(o, at + runtime64Data[i][0], FIX_DATA, runtime64Data[i][1], 0);
+}
+
+//Allocate a variable in the data, with its initial value
+void objVar(Object *o, int id, int value) {
+	int i = o->varCapacity;
+	o->varAt = grow(o->varAt, &o->varCapacity, id + 1, sizeof(int));
+	for (; i < o->varCapacity; i++)
+		o->varAt[i] = -1;
+	o->varAt[id] = o->data.count;
+	put32(&o->data, value);
+}
+
+//Emit a REX prefix if the ModRM reg field r or r/m register b needs one
+//  r or b is -1 if it is not a register; byteRm says b is a low byte register
+static void rex(Object *o, int r, int b, int byteRm) {
+	int x = 0x40 | (r >= 8 ? 4 : 0) | (b >= 8 ? 1 : 0);
+	//Without a REX prefix, bytes 4 to 7 are %ah to %bh, not %spl to %dil
+	if (0x40 != x || (byteRm && b >= 4))
+		put(&o->text, x);
+}
+
+//Emit an opcode (one byte, or 0x0F and one) and a ModRM byte
+//  r is the reg field: a register or an opcode extension
+//  The r/m operand is a register or a variable; tail is the number of
+//  bytes that will follow the ModRM, which a RIP-relative variable needs
+static void modrm(Object *o, int opcode, int r, int kind, int value, int tail) {
+	rex(o, r, O_VAR == kind ? -1 : value, O_REG8 == kind);
+	if (opcode > 0xff)
+		put(&o->text, opcode >> 8);
+	put(&o->text, opcode & 0xff);
+	if (O_VAR == kind) {
+		put(&o->text, 0x05 | (r & 7) << 3); //disp32(%rip)
+		fixup(o, FIX_DATA, o->varAt[value], tail);
+	}
+	else
+		put(&o->text, 0xc0 | (r & 7) << 3 | (value & 7));
+}
+
+//Encode an instruction with an immediate: 8 bits if it fits, else 32
+static void immediate(Object *o, int op8, int op32, int r, int kind, int value, int n) {
+	if (isByte(n)) {
+		modrm(o, op8, r, kind, value, 1);
+		put(&o->text, n & 0xff);
+	}
+	else {
+		modrm(o, op32, r, kind, value, 4);
+		put32(&o->text, n);
+	}
+}
+
+//Encode add, or, and, sub, xor or cmp
+//  base is the opcode of the byte form, base >> 3 its extension for immediates
+static void alu(Object *o, const Instr *in, int base) {
+	if (O_IMM == in->srcKind) {
+		if (O_REG == in->dstKind && R_AX == in->dst && !isByte(in->src)) {
+			put(&o->text, base + 5); //op $n,%eax has a short form
+			put32(&o->text, in->src);
+		}
+		else
+			immediate(o, 0x83, 0x81, base >> 3, in->dstKind, in->dst, in->src);
+	}
+	else if (O_REG == in->srcKind)
+		modrm(o, base + 1, in->src, in->dstKind, in->dst, 0);
+	else
+		modrm(o, base + 3, in->dst, in->srcKind, in->src, 0);
+}
+
+//Encode one instruction
+static void encode(Object *o, const Instr *in) {
+	Jump *j;
+	int r;
+	switch (in->op) {
+		case OP_MOV:
+			if (O_IMM == in->srcKind && O_REG == in->dstKind) {
+				rex(o, -1, in->dst, 0);
+				put(&o->text, 0xb8 + (in->dst & 7));
+				put32(&o->text, in->src);
+			}
+			else if (O_IMM == in->srcKind) {
+				modrm(o, 0xc7, 0, in->dstKind, in->dst, 4);
+				put32(&o->text, in->src);
+			}
+			else if (O_REG == in->srcKind)
+				modrm(o, 0x89, in->src, in->dstKind, in->dst, 0);
+			else
+				modrm(o, 0x8b, in->dst, in->srcKind, in->src, 0);
+			break;
+		case OP_MOVSX:
+			modrm(o, 0x0fbe, in->dst, in->srcKind, in->src, 0);
+			break;
+		case OP_ADD:
+			alu(o, in, 0x00);
+			break;
+		case OP_OR:
+			alu(o, in, 0x08);
+			break;
+		case OP_AND:
+			alu(o, in, 0x20);
+			break;
+		case OP_SUB:
+			alu(o, in, 0x28);
+			break;
+		case OP_XOR:
+			alu(o, in, 0x30);
+			break;
+		case OP_CMP:
+			alu(o, in, 0x38);
+			break;
+		case OP_TEST:
+			modrm(o, 0x85, in->src, in->dstKind, in->dst, 0);
+			break;
+		case OP_NOT:
+			modrm(o, O_REG8 == in->srcKind ? 0xf6 : 0xf7, 2, in->srcKind, in->src, 0);
+			break;
+		case OP_NEG:
+			modrm(o, O_REG8 == in->srcKind ? 0xf6 : 0xf7, 3, in->srcKind, in->src, 0);
+			break;
+		case OP_MUL:
+			modrm(o, 0xf7, 4, in->srcKind, in->src, 0);
+			break;
+		case OP_DIV:
+			modrm(o, 0xf7, 6, in->srcKind, in->src, 0);
+			break;
+		case OP_SHR:
+			modrm(o, 0xc1, 5, in->dstKind, in->dst, 1);
+			put(&o->text, in->src);
+			break;
+		case OP_IMUL:
+			if (O_IMM == in->srcKind)
+				immediate(o, 0x6b, 0x69, in->dst, O_REG, in->dst, in->src);
+			else
+				modrm(o, 0x0faf, in->dst, in->srcKind, in->src, 0);
+			break;
+		case OP_XCHG:
+			if (R_AX == in->src || R_AX == in->dst) {
+				r = R_AX == in->src ? in->dst : in->src;
+				rex(o, -1, r, 0);
+				put(&o->text, 0x90 + (r & 7)); //xchg with %eax has a short form
+			}
+			else
+				modrm(o, 0x87, in->src, O_REG, in->dst, 0);
+			break;
+		case OP_PUSH:
+		case OP_POP:
+			rex(o, -1, in->src, 0);
+			put(&o->text, (OP_PUSH == in->op ? 0x50 : 0x58) + (in->src & 7));
+			break;
+		case OP_SET:
+			modrm(o, 0x0f90 + in->cond, 0, in->srcKind, in->src, 0);
+			break;
+		case OP_JMP:
+		case OP_JCC:
+			o->jump = grow(o->jump, &o->jumpCapacity, o->jumpCount + 1, sizeof(Jump));
+			j = &o->jump[o->jumpCount++];
+			j->at = o->text.count;
+			j->label = in->src;
+			j->op = in->op;
+			j->cond = in->cond;
+			j->size = 2;
+			break;
+		case OP_CALL:
+			put(&o->text, 0xe8);
+			fixup(o, FIX_CALL, o->funcAt[in->src], 0);
+			break;
+		case OP_LABEL:
+			r = o->labelCapacity;
+			o->labelAt = grow(o->labelAt, &o->labelCapacity, in->src + 1, sizeof(int));
+			if (r != o->labelCapacity) {
+				o->labelJumps = realloc(o->labelJumps, o->labelCapacity * sizeof(int));
+				if (NULL == o->labelJumps)
+					abort();
+				for (; r < o->labelCapacity; r++)
+					o->labelAt[r] = -1;
+			}
+			o->labelAt[in->src] = o->text.count;
+			o->labelJumps[in->src] = o->jumpCount;
+			break;
+		case OP_COMMENT:
+			break;
+	}
+}
+
+//Encode the instructions generated so far
+void encodeCode(Object *o, Code *code) {
+	int i;
+	for (i = 0; i < code->count; i++)
+		encode(o, &code->instr[i]);
+	code->count = 0;
+}
+
+//Finish main and put the jumps in, as short as they can be
+void objEnd(Object *o) {
+	int *before; //Bytes of jumps before each jump, and in all at the end
+	Bytes text;
+	Jump *j;
+	int i, changed, at, d, from;
+
+	fixupAt(o, o->text.count + epilog64Call, FIX_CALL, o->funcAt[FN_FLUSHOUTPUT], 0);
+	putBytes(&o->text, epilog64Code, epilog64Size);
+	before = malloc((o->jumpCount + 1) * sizeof(int));
+	if (NULL == before)
+		abort();
+	do {
+		changed = 0;
+		before[0] = 0;
+		for (i = 0; i < o->jumpCount; i++)
+			before[i + 1] = before[i] + o->jump[i].size;
+		for (i = 0; i < o->jumpCount; i++) {
+			j = &o->jump[i];
+			if (2 != j->size)
+				continue;
+			d = o->labelAt[j->label] + before[o->labelJumps[j->label]] - (j->at + before[i] + 2);
+			if (!isByte(d)) {
+				j->size = OP_JMP == j->op ? 5 : 6;
+				changed = 1;
+			}
+		}
+	} while (changed);
+
+	//Copy the text with the jumps in
+	memset(&text, 0, sizeof text);
+	from = 0;
+	for (i = 0; i < o->jumpCount; i++) {
+		j = &o->jump[i];
+		putBytes(&text, o->text.b + from, j->at - from);
+		from = j->at;
+		d = o->labelAt[j->label] + before[o->labelJumps[j->label]] - (j->at + before[i] + j->size);
+		if (2 == j->size) {
+			put(&text, OP_JMP == j->op ? 0xeb : 0x70 + j->cond);
+			put(&text, d & 0xff);
+			o->shortJumps++;
+		}
+		else {
+			if (OP_JCC == j->op)
+				put(&text, 0x0f);
+			put(&text, OP_JMP == j->op ? 0xe9 : 0x80 + j->cond);
+			put32(&text, d);
+		}
+	}
+	putBytes(&text, o->text.b + from, o->text.count - from);
+	free(o->text.b);
+	o->text = text;
+
+	//Move the fields past the jumps, and fill in the calls
+	for (i = 0; i < o->fixCount; i++) {
+		at = o->fix[i].at += before[o->fix[i].jumps];
+		if (FIX_CALL == o->fix[i].kind)
+			set32(o->text.b + at, o->fix[i].target - (at + 4 + o->fix[i].tail));
+	}
+	free(before);
+}
+
+//Fill in the references to the data, once the text and data have addresses
+void objPlace(Object *o, long textAddress, long dataAddress) {
+	const Fixup *f;
+	int i;
+	for (i = 0; i < o->fixCount; i++) {
+		f = &o->fix[i];
+		if (FIX_DATA == f->kind)
+			set32(o->text.b + f->at, dataAddress + f->target - (textAddress + f->at + 4 + f->tail));
+	}
+}
+
+void freeObject(Object *o) {
+	free(o->text.b);
+	free(o->data.b);
+	free(o->jump);
+	free(o->labelAt);
+	free(o->labelJumps);
+	free(o->fix);
+	free(o->varAt);
+	memset(o, 0, sizeof *o);
+}
@@ -0,0 +1,72 @@
+/*
+ *  encode.h
+ *  Lets's Build a Compiler
+ *  Integrated assembler. Turns the instruction stream straight into x86-64
+ *  machine code, so an object file or executable can be written without
+ *  running an assembler.
+ *
+ */
+
+//Output formats
+enum {
+	FORMAT_ASM, //Assembly text, the default
+	FORMAT_OBJ, //Relocatable ELF object, for linking with the C library
+	FORMAT_EXE, //Static ELF executable
+	FORMAT_RUN, //Run in memory, with --run
+	FORMAT_VM //Run as bytecode, with --vm
+};
+
+//A growing array of bytes
+typedef struct {
+	unsigned char *b;
+	int count;
+	int capacity;
+} Bytes;
+
+//A jump to a label, which may still be 2 bytes or grow to 5 or 6
+typedef struct {
+	int at; //Offset in the text where the jump goes, before relaxation
+	int label;
+	unsigned char op; //OP_JMP or OP_JCC
+	unsigned char cond;
+	unsigned char size;
+} Jump;
+
+//A 32-bit PC-relative field
+typedef struct {
+	int at; //Offset in the text; before relaxation, the offset without the jumps
+	int jumps; //Jumps in the text before it
+	int kind; //FIX_CALL or FIX_DATA
+	int target; //Offset in the text of the routine called, or in the data
+	int tail; //Bytes of the instruction after the field
+} Fixup;
+
+enum { FIX_CALL, FIX_DATA };
+
+typedef struct {
+	int format;
+	Bytes text; //Machine code, without the jumps until objEnd
+	Bytes data; //The runtime's data, then the variables
+	Jump *jump;
+	int jumpCount;
+	int jumpCapacity;
+	int *labelAt; //Offset of each label in the text, before relaxation, or -1
+	int *labelJumps; //Jumps in the text before it
+	int labelCapacity;
+	Fixup *fix;
+	int fixCount;
+	int fixCapacity;
+	int *varAt; //Offset of each variable in the data, by symbol ID, or -1
+	int varCapacity;
+	int funcAt[fnCount]; //Offset of each runtime routine in the text, by FN_...
+	int mainAt; //Offset of main
+	int shortJumps; //Jumps that stayed 2 bytes, after objEnd
+} Object;
+
+void objStart(Object *o, int format);
+void objProlog(Object *o, void *const helper[fnCount]);
+void objVar(Object *o, int id, int value);
+void encodeCode(Object *o, Code *code);
+void objEnd(Object *o);
+void objPlace(Object *o, long textAddress, long dataAddress);
+void freeObject(Object *o);
@@ -0,0 +1,141 @@
+/*
+ *  input.c
+ *  Lets's Build a Compiler
+ *  Source input layer. The whole program text is made available as one
+ *  contiguous buffer so the scanner can walk a pointer over it instead of
+ *  calling into stdio for every character.
+ *
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include "input.h"
+
+#define LF 0x0A
+
+const unsigned char charClass[256] = {
+	[' '] = C_WHITE, ['\t'] = C_WHITE,
+	['\r'] = C_EOL, ['\n'] = C_EOL,
+	['A' ... 'Z'] = C_ALPHA, ['a' ... 'z'] = C_ALPHA,
+	['0' ... '9'] = C_DIGIT,
+	['+'] = C_ADDOP, ['-'] = C_ADDOP,
+	['*'] = C_MULOP, ['/'] = C_MULOP,
+	['|'] = C_OROP, ['~'] = C_OROP,
+	['='] = C_RELOP, ['#'] = C_RELOP, ['<'] = C_RELOP, ['>'] = C_RELOP
+};
+
+#define U4(c) c, c + 1, c + 2, c + 3
+#define U16(c) U4(c), U4(c + 4), U4(c + 8), U4(c + 12)
+#define U32(c) U16(c), U16(c + 16)
+
+//Each character maps to itself except a-z, which map to A-Z
+const unsigned char upperCase[256] = {
+	U32(0x00), U32(0x20), U32(0x40),
+	0x60, 'A', 'B', 'C', 'D', 'E', 'F', 'G', 'H', 'I', 'J', 'K', 'L', 'M', 'N', 'O',
+	'P', 'Q', 'R', 'S', 'T', 'U', 'V', 'W', 'X', 'Y', 'Z', 0x7B, 0x7C, 0x7D, 0x7E, 0x7F,
+	U32(0x80), U32(0xA0), U32(0xC0), U32(0xE0)
+};
+
+//Map a regular file into memory
+//Returns 0 on success, -1 if the file can't be mapped
+static int mapSource(Source *src, int fd, size_t len) {
+	void *p = mmap(NULL, len, PROT_READ, MAP_PRIVATE, fd, 0);
+	if (MAP_FAILED == p)
+		return -1;
+#ifdef MADV_SEQUENTIAL
+	madvise(p, len, MADV_SEQUENTIAL);
+#endif
+	src->buf = p;
+	src->len = len;
+	src->mapped = 1;
+	return 0;
+}
+
+//Read a pipe or terminal into a growable buffer in large blocks
+//Returns 0 on success, -1 on a read error
+static int readSource(Source *src, int fd) {
+	size_t cap = INPUT_BLOCKSIZE;
+	size_t len = 0;
+	char *buf = malloc(cap);
+	ssize_t n;
+	if (NULL == buf)
+		return -1;
+	for (;;) {
+		if (cap - len < INPUT_BLOCKSIZE) {
+			char *p = realloc(buf, cap * 2);
+			if (NULL == p) {
+				free(buf);
+				return -1;
+			}
+			buf = p;
+			cap *= 2;
+		}
+		n = read(fd, buf + len, cap - len);
+		if (n < 0) {
+			free(buf);
+			return -1;
+		}
+		if (0 == n)
+			break;
+		len += n;
+	}
+	src->buf = buf;
+	src->len = len;
+	src->mapped = 0;
+	return 0;
+}
+
+//Make the source available in memory
+//  path is the file to compile, or NULL for stdin
+//  Returns 0 on success, -1 on failure
+int openSource(Source *src, const char *path) {
+	struct stat st;
+	int fd = 0;
+	int result = -1;
+	
+	memset(src, 0, sizeof *src);
+	if (NULL != path) {
+		fd = open(path, O_RDONLY);
+		if (fd < 0)
+			return -1;
+	}
+	if (0 == fstat(fd, &st) && S_ISREG(st.st_mode) && st.st_size > 0)
+		result = mapSource(src, fd, st.st_size);
+	if (0 != result)
+		result = readSource(src, fd);
+	if (NULL != path)
+		close(fd);
+	if (0 == result) {
+		src->ptr = src->buf;
+		src->end = src->buf + src->len;
+	}
+	return result;
+}
+
+//Find the line number of an offset into the source
+int sourceLine(const Source *src, unsigned offset) {
+	const char *p = src->buf;
+	const char *end = src->buf + (offset < src->len ? offset : src->len);
+	int line = 1;
+	if (NULL == p)
+		return line;
+	while (NULL != (p = memchr(p, LF, end - p))) {
+		p++;
+		line++;
+	}
+	return line;
+}
+
+//Release the source buffer
+void closeSource(Source *src) {
+	if (src->mapped)
+		munmap(src->buf, src->len);
+	else
+		free(src->buf);
+	memset(src, 0, sizeof *src);
+}
@@ -0,0 +1,84 @@
+/*
+ *  input.h
+ *  Lets's Build a Compiler
+ *  Source input layer. The whole program text is made available as one
+ *  contiguous buffer so the scanner can walk a pointer over it instead of
+ *  calling into stdio for every character.
+ *
+ */
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+#ifdef __AVX2__
+#include <immintrin.h>
+#endif
+
+#include <stddef.h>
+
+#define INPUT_BLOCKSIZE (1024 * 1024)
+
+//Character classes, one bit each in charClass[]
+#define C_WHITE 0x01 //space, tab
+#define C_EOL 0x02 //CR, LF
+#define C_ALPHA 0x04
+#define C_DIGIT 0x08
+#define C_ADDOP 0x10 //+ -
+#define C_MULOP 0x20 //* /
+#define C_OROP 0x40 //| ~
+#define C_RELOP 0x80 //= # < >
+
+extern const unsigned char charClass[256];
+extern const unsigned char upperCase[256];
+
+//Test a character (or EOF, which is in no class) against a set of classes
+#define charIs(c, classes) (charClass[(unsigned char)(c)] & (classes))
+
+//Convert a character to upper case
+#define toUpper(c) (upperCase[(unsigned char)(c)])
+
+//A source program held in memory
+typedef struct {
+	const char *ptr; //Next character to be scanned
+	const char *end; //One past the last character of the source
+	char *buf; //Start of the source buffer
+	size_t len; //Length of the source buffer
+	int mapped; //Non-zero if buf came from mmap()
+} Source;
+
+int openSource(Source *src, const char *path);
+void closeSource(Source *src);
+int sourceLine(const Source *src, unsigned offset);
+
+//Skip a run of spaces and tabs starting at p
+//Returns a pointer to the first other character, or end
+//Long runs are checked a vector at a time
+static inline const char *skipBlanks(const char *p, const char *end) {
+	if (p < end && !charIs(*p, C_WHITE))
+		return p; //The usual case: a single blank
+#ifdef __AVX2__
+	while (end - p >= 32) {
+		__m256i v = _mm256_loadu_si256((const __m256i *)p);
+		unsigned blank = _mm256_movemask_epi8(_mm256_or_si256(
+			_mm256_cmpeq_epi8(v, _mm256_set1_epi8(' ')),
+			_mm256_cmpeq_epi8(v, _mm256_set1_epi8('\t'))));
+		if (0xFFFFFFFFu != blank)
+			return p + __builtin_ctz(~blank);
+		p += 32;
+	}
+#endif
+#ifdef __SSE2__
+	while (end - p >= 16) {
+		__m128i v = _mm_loadu_si128((const __m128i *)p);
+		unsigned blank = _mm_movemask_epi8(_mm_or_si128(
+			_mm_cmpeq_epi8(v, _mm_set1_epi8(' ')),
+			_mm_cmpeq_epi8(v, _mm_set1_epi8('\t'))));
+		if (0xFFFFu != blank)
+			return p + __builtin_ctz(~blank);
+		p += 16;
+	}
+#endif
+	while (p < end && charIs(*p, C_WHITE))
+		p++;
+	return p;
+}
@@ -0,0 +1,116 @@
+/*
+ *  jit.c
+ *  Lets's Build a Compiler
+ *  In-memory execution. With --run, the machine code is loaded into this
+ *  process and main is called directly: no assembler, linker or exec.
+ *
+ *  The text and data are copied into one mapping, so the data is in reach
+ *  of RIP-relative addressing. The mapping is writable while the code is
+ *  copied and patched, and the text is then made executable and read-only;
+ *  no page is ever writable and executable at once.
+ *
+ *  The runtime routines are the C functions in runtime.c. The program
+ *  calls them through short stubs (see helper64Code) that keep the
+ *  registers it relies on.
+ *
+ *  The --tiered VM loads each loop it compiles the same way, and keeps it
+ *  loaded for the next time the loop comes round.
+ *
+ *  Profilers can't see code that has no file behind it, so the addresses
+ *  of main and the stubs are written to /tmp/perf-PID.map, which perf
+ *  reads to name them.
+ *
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include "output.h"
+#include "code.h"
+#include "asmheader.h"
+#include "encode.h"
+#include "runtime.h"
+#include "jit.h"
+
+#ifndef MAP_ANONYMOUS
+#define MAP_ANONYMOUS MAP_ANON
+#endif
+
+void *const jitHelper[fnCount] = {
+	[FN_CONVERTTOASCII] = (void *)rtConvertToAscii,
+	[FN_CONVERTFROMASCII] = (void *)rtConvertFromAscii,
+	[FN_WRITEIOBUF] = (void *)rtWriteIobuf,
+	[FN_READIOBUF] = (void *)rtReadIobuf,
+	[FN_FLUSHOUTPUT] = (void *)rtFlushOutput
+};
+
+//Tell perf what the code at each address is
+//  Every load adds to the map, so the loops compiled by --tiered get names too.
+//  The map is only an aid, so failing to write it is not an error
+static void writePerfMap(const Object *o, const unsigned char *base, const char *symbol) {
+	char path[64];
+	FILE *f;
+	int i;
+	snprintf(path, sizeof path, "/tmp/perf-%d.map", (int)getpid());
+	f = fopen(path, "a");
+	if (NULL == f)
+		return;
+	for (i = 0; i < fnCount; i++)
+		fprintf(f, "%lx %x %s\n", (unsigned long)(base + o->funcAt[i]), helper64Size, runtime64Name[i]);
+	fprintf(f, "%lx %x %s\n", (unsigned long)(base + o->mainAt), o->text.count - o->mainAt, symbol);
+	fclose(f);
+}
+
+//Load a finished object into memory, ready to call
+//  symbol names its main in the perf map
+//  Returns 0, or -1 if the code can't be run
+int jitLoad(JitCode *j, Object *o, const char *symbol) {
+#if defined(__x86_64__)
+	long page = sysconf(_SC_PAGESIZE);
+	long textSize = (o->text.count + page - 1) / page * page;
+	long dataSize = (o->data.count + page - 1) / page * page;
+	unsigned char *base;
+
+	memset(j, 0, sizeof *j);
+	base = mmap(NULL, textSize + dataSize, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if (MAP_FAILED == base)
+		return -1;
+	objPlace(o, (long)base, (long)(base + textSize));
+	memcpy(base, o->text.b, o->text.count);
+	memcpy(base + textSize, o->data.b, o->data.count);
+	if (0 != mprotect(base, textSize, PROT_READ | PROT_EXEC)) {
+		munmap(base, textSize + dataSize);
+		return -1;
+	}
+	writePerfMap(o, base, symbol);
+	j->base = base;
+	j->size = textSize + dataSize;
+	j->data = base + textSize;
+	j->entry = (int (*)(void))(base + o->mainAt);
+	return 0;
+#else
+	//The code is x86-64, which this host can't run
+	return -1;
+#endif
+}
+
+void jitFree(JitCode *j) {
+	if (NULL != j->base)
+		munmap(j->base, j->size);
+	memset(j, 0, sizeof *j);
+}
+
+//Load a finished object and call its main
+//  name is the source file, for the perf map, or NULL for stdin
+//  Returns 0 with what main returned in *status, or -1 if the code can't be run
+int jitRun(Object *o, const char *name, int *status) {
+	char symbol[256];
+	JitCode j;
+	snprintf(symbol, sizeof symbol, "main [%s]", name ? name : "stdin");
+	if (0 != jitLoad(&j, o, symbol))
+		return -1;
+	*status = j.entry();
+	jitFree(&j);
+	return 0;
+}
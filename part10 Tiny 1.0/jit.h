@@ -0,0 +1,21 @@
+/*
+ *  jit.h
+ *  Lets's Build a Compiler
+ *  In-memory execution. With --run, the machine code is loaded into this
+ *  process and main is called directly: no assembler, linker or exec.
+ *
+ */
+
+extern void *const jitHelper[fnCount]; //The runtime routines in C, by FN_...
+
+//Machine code loaded into memory
+typedef struct {
+	unsigned char *base; //The text, then the data
+	long size;
+	unsigned char *data;
+	int (*entry)(void); //main
+} JitCode;
+
+int jitLoad(JitCode *j, Object *o, const char *symbol);
+void jitFree(JitCode *j);
+int jitRun(Object *o, const char *name, int *status);
@@ -0,0 +1,303 @@
+/*
+ *  lexer.c
+ *  Lets's Build a Compiler
+ *  Lexical scanner. The whole source is turned into an array of tokens in
+ *  one tight pass before parsing; the parser then consumes tokens by index.
+ *
+ *  Large sources are split at line boundaries and lexed on several threads.
+ *  Tiny tokens never span lines, so each chunk can be scanned on its own;
+ *  the chunks' token arrays are then stitched back together in order.
+ *
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include "input.h"
+#include "lexer.h"
+#include "symtab.h"
+
+#define LF 0x0A
+
+//A name seen by one chunk, before it has a global symbol ID
+typedef struct {
+	const char *s; //Points into the source, in whatever case it was written
+	int len;
+	unsigned hash;
+} LocalName;
+
+//One chunk of the source and the tokens lexed from it
+typedef struct {
+	const char *base; //Token offsets are measured from here
+	const char *start;
+	const char *end;
+	SymbolTable *syms;
+	TokenVec vec;
+	//Names local to this chunk; token values are indices into names[]
+	LocalName *names;
+	int nameCount;
+	int nameCapacity;
+	int *slots; //Local name index + 1 for each slot, 0 if the slot is empty
+	unsigned slotMask;
+	int *remap; //Global symbol ID for each local name
+	int first; //Index in the stitched array of this chunk's first kept token
+	Token *out; //Where that token goes, once the array is allocated
+	int skip; //Leading tokens dropped while stitching
+} Chunk;
+
+//Allocate memory or halt
+static void *xrealloc(void *p, size_t size) {
+	p = realloc(p, size);
+	if (NULL == p)
+		abort();
+	return p;
+}
+
+//Append a token
+static inline void addToken(TokenVec *v, int kind, int value, unsigned offset) {
+	Token *t;
+	if (v->count == v->capacity) {
+		v->capacity = v->capacity ? 2 * v->capacity : 4096;
+		v->t = xrealloc(v->t, v->capacity * sizeof(Token));
+	}
+	t = &v->t[v->count++];
+	t->kind = kind;
+	t->value = value;
+	t->offset = offset;
+}
+
+//Compare two names from the source, ignoring case
+static int sameName(const LocalName *n, const char *s, int len) {
+	int i;
+	if (n->len != len)
+		return 0;
+	for (i = 0; i < len; i++) {
+		if (toUpper(n->s[i]) != toUpper(s[i]))
+			return 0;
+	}
+	return 1;
+}
+
+//Double a chunk's slot array and rehash its names into it
+static void growLocal(Chunk *c) {
+	unsigned count = c->slots ? 2 * (c->slotMask + 1) : 256;
+	int i;
+	free(c->slots);
+	c->slots = calloc(count, sizeof(int));
+	if (NULL == c->slots)
+		abort();
+	c->slotMask = count - 1;
+	for (i = 0; i < c->nameCount; i++) {
+		unsigned j = c->names[i].hash & c->slotMask;
+		while (0 != c->slots[j])
+			j = (j + 1) & c->slotMask;
+		c->slots[j] = i + 1;
+	}
+}
+
+//Intern a name in a chunk's local table
+//Returns its local index
+static int internLocal(Chunk *c, const char *s, int len, unsigned hash) {
+	unsigned i;
+	LocalName *n;
+	if (NULL == c->slots || 2 * (unsigned)(c->nameCount + 1) > c->slotMask + 1)
+		growLocal(c);
+	for (i = hash & c->slotMask; 0 != c->slots[i]; i = (i + 1) & c->slotMask) {
+		n = &c->names[c->slots[i] - 1];
+		if (n->hash == hash && sameName(n, s, len))
+			return c->slots[i] - 1;
+	}
+	if (c->nameCount == c->nameCapacity) {
+		c->nameCapacity = c->nameCapacity ? 2 * c->nameCapacity : 256;
+		c->names = xrealloc(c->names, c->nameCapacity * sizeof(LocalName));
+	}
+	n = &c->names[c->nameCount];
+	n->s = s;
+	n->len = len;
+	n->hash = hash;
+	c->slots[i] = ++c->nameCount;
+	return c->nameCount - 1;
+}
+
+//Scan one chunk of the source into c->vec
+//  Blanks separate tokens and are dropped. A run of end-of-lines, with any
+//  blanks between them, becomes a single TK_EOL.
+//  With local set, names go into the chunk's own table so that several
+//  chunks can be scanned at once; otherwise they are interned directly.
+static inline void lexChunk(Chunk *c, int local) {
+	const char *base = c->base;
+	const char *p = c->start;
+	const char *end = c->end;
+	
+	while (p < end) {
+		const char *start = p;
+		unsigned char ch = *p;
+		int cls = charClass[ch];
+		if (cls & C_WHITE) {
+			p = skipBlanks(p + 1, end);
+		}
+		else if (cls & C_EOL) {
+			while (p < end && charIs(*p, C_EOL | C_WHITE))
+				p++;
+			addToken(&c->vec, TK_EOL, 0, start - base);
+		}
+		else if (cls & C_ALPHA) {
+			unsigned hash = hashInit;
+			int id;
+			do {
+				hash = hashStep(hash, toUpper(*p));
+				p++;
+			} while (p < end && charIs(*p, C_ALPHA | C_DIGIT));
+			if (local)
+				id = internLocal(c, start, p - start, hash);
+			else
+				id = symIntern(c->syms, start, p - start, hash);
+			addToken(&c->vec, TK_NAME, id, start - base);
+		}
+		else if (cls & C_DIGIT) {
+			unsigned n = 0;
+			do {
+				n = 10 * n + (*p - '0');
+				p++;
+			} while (p < end && charIs(*p, C_DIGIT));
+			addToken(&c->vec, TK_NUM, (int)n, start - base);
+		}
+		else {
+			p++;
+			if (ch > ' ' && ch < 0x7F)
+				addToken(&c->vec, ch, 0, start - base);
+			else
+				addToken(&c->vec, TK_OTHER, ch, start - base);
+		}
+	}
+}
+
+//Thread body: lex one chunk into its local tables
+static void *lexWorker(void *arg) {
+	lexChunk(arg, 1);
+	return NULL;
+}
+
+//Thread body: copy one chunk's tokens into place, translating name IDs
+static void *stitchWorker(void *arg) {
+	Chunk *c = arg;
+	Token *out = c->out;
+	int i;
+	for (i = c->skip; i < c->vec.count; i++) {
+		*out = c->vec.t[i];
+		if (TK_NAME == out->kind)
+			out->value = c->remap[out->value];
+		out++;
+	}
+	return NULL;
+}
+
+//Run fn on every chunk, one thread each
+static void runChunks(Chunk *chunks, int n, void *(*fn)(void *)) {
+	pthread_t *threads = xrealloc(NULL, n * sizeof(pthread_t));
+	int i;
+	for (i = 1; i < n; i++) {
+		if (0 != pthread_create(&threads[i], NULL, fn, &chunks[i]))
+			abort();
+	}
+	fn(&chunks[0]); //The calling thread takes the first chunk
+	for (i = 1; i < n; i++)
+		pthread_join(threads[i], NULL);
+	free(threads);
+}
+
+//Lex the source on n threads
+static void lexParallel(const Source *src, SymbolTable *syms, TokenVec *toks, int n) {
+	Chunk *chunks = calloc(n, sizeof(Chunk));
+	const char *srcPtr = src->ptr;
+	const char *srcEnd = src->end;
+	size_t len = srcEnd - srcPtr;
+	const char *p = srcPtr;
+	Token *tokens;
+	int total = 0;
+	int i, j;
+	
+	if (NULL == chunks)
+		abort();
+	//Split just after a line feed near each 1/n of the source
+	for (i = 0; i < n; i++) {
+		const char *end = srcPtr + len / n * (i + 1);
+		if (i == n - 1 || end <= p)
+			end = srcEnd;
+		else {
+			end = memchr(end, LF, srcEnd - end);
+			end = end ? end + 1 : srcEnd;
+		}
+		chunks[i].base = srcPtr;
+		chunks[i].start = p;
+		chunks[i].end = end;
+		p = end;
+	}
+	runChunks(chunks, n, lexWorker);
+	
+	//Give the local names global IDs, chunk by chunk so the IDs come out in
+	//  order of first appearance, just as a single-threaded scan assigns them
+	for (i = 0; i < n; i++) {
+		Chunk *c = &chunks[i];
+		c->remap = xrealloc(NULL, (c->nameCount + 1) * sizeof(int));
+		for (j = 0; j < c->nameCount; j++)
+			c->remap[j] = symIntern(syms, c->names[j].s, c->names[j].len, c->names[j].hash);
+		//A chunk starts on a new line. If it opens with an end-of-line it
+		//  continues the run of end-of-lines that ended the last chunk.
+		if (total > 0 && c->vec.count > 0 && TK_EOL == c->vec.t[0].kind)
+			c->skip = 1;
+		c->first = total;
+		total += c->vec.count - c->skip;
+	}
+	
+	tokens = xrealloc(NULL, (total + 1) * sizeof(Token));
+	for (i = 0; i < n; i++)
+		chunks[i].out = tokens + chunks[i].first;
+	runChunks(chunks, n, stitchWorker);
+	tokens[total].kind = TK_EOF;
+	tokens[total].value = 0;
+	tokens[total].offset = len;
+	toks->t = tokens;
+	toks->count = total + 1;
+	toks->capacity = total + 1;
+	
+	for (i = 0; i < n; i++) {
+		free(chunks[i].vec.t);
+		free(chunks[i].names);
+		free(chunks[i].slots);
+		free(chunks[i].remap);
+	}
+	free(chunks);
+}
+
+//Scan the source buffer into toks
+//  The array always ends with a TK_EOF.
+//  Sources big enough to be worth it are lexed on up to threads threads.
+void lex(const Source *src, SymbolTable *syms, TokenVec *toks, int threads) {
+	int n = threads;
+	size_t len = src->end - src->ptr;
+	
+	if (n > lexMaxThreads)
+		n = lexMaxThreads;
+	if ((size_t)n > len / lexMinChunk)
+		n = len / lexMinChunk;
+	if (n > 1)
+		lexParallel(src, syms, toks, n);
+	else {
+		Chunk c;
+		memset(&c, 0, sizeof c);
+		c.base = src->ptr;
+		c.start = src->ptr;
+		c.end = src->end;
+		c.syms = syms;
+		lexChunk(&c, 0);
+		addToken(&c.vec, TK_EOF, 0, len);
+		*toks = c.vec;
+	}
+}
+
+//Release a token array
+void freeTokens(TokenVec *toks) {
+	free(toks->t);
+	memset(toks, 0, sizeof *toks);
+}
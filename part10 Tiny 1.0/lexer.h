@@ -0,0 +1,37 @@
+/*
+ *  lexer.h
+ *  Lets's Build a Compiler
+ *  Lexical scanner. The whole source is turned into an array of tokens in
+ *  one tight pass before parsing; the parser then consumes tokens by index.
+ *
+ */
+
+//Token kinds
+//  Punctuation tokens are their own character ('+', '(', '=', ...), so the
+//  parser can compare look against characters as it always has.
+#define TK_EOF 0x00
+#define TK_NAME 0x01 //value is the symbol ID
+#define TK_NUM 0x02 //value is the number
+#define TK_EOL 0x03 //A run of end-of-lines and blank lines
+#define TK_OTHER 0x04 //A control or non-ASCII byte; value is the byte
+
+typedef struct {
+	unsigned char kind;
+	int value;
+	unsigned offset; //Offset of the token in the source
+} Token;
+
+#define lexMaxThreads 64
+#define lexMinChunk (1024 * 1024) //Smallest chunk worth a thread of its own
+
+//A growable token array
+typedef struct {
+	Token *t;
+	int count;
+	int capacity;
+} TokenVec;
+
+struct SymbolTable;
+
+void lex(const Source *src, struct SymbolTable *syms, TokenVec *toks, int threads);
+void freeTokens(TokenVec *toks);
@@ -3,246 +3,210 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
-#include <ctype.h>
 #include <stdarg.h>
+#include <unistd.h>
+#include <getopt.h>
 
+#include "input.h"
+#include "symtab.h"
+#include "output.h"
 #include "asmheader.h"
-
-#define LF 0x0A
-#define CR 0x0D
+#include "code.h"
+#include "lexer.h"
+#include "ast.h"
+#include "peep.h"
+#include "regalloc.h"
+#include "encode.h"
+#include "elf.h"
+#include "jit.h"
+#include "vm.h"
+#include "compiler.h"
 
 #define errbufsize 1024
-#define labelbufsize 10
-#define tokenbuflen 64
-#define maxSymbols 100
-
-int look;
-int labelCount = 0;
-int symbolCount = 0;
-
-char *symbolTable[maxSymbols];
-char symbolType[maxSymbols];
+#define condMaxDepth 1000 //Deepest & and | nesting compiled to jumps; deeper conditions are evaluated
+#define exprMaxDepth 1000 //Deepest expression nesting given registers; deeper is stack machine code
 
 //define keywords and token types
 #pragma mark Keyaords and Token Types
-#define kwCount 11
-char *kwList[kwCount] = {"IF", "ELSE", "ENDIF", "WHILE", "ENDWHILE",
-"READ", "WRITE", "VAR", "BEGIN", "END", "PROGRAM"};
-const char kwCode[kwCount + 1] = {"xileweRWvbep"};
-
-char token; //Current token type
-char value[tokenbuflen]; //Current token string
+//Keywords are found with a perfect hash of the first two characters and
+//  the length: (c0 + 4*c1 + len) mod 16 is distinct for all 11 keywords.
+//  Slots that no keyword hashes to have length 0 and never match.
+#define kwMinLen 2
+#define kwMaxLen 8
+#define kwHash(s, len) (((unsigned char)(s)[0] + 4 * (unsigned char)(s)[1] + (len)) & 15)
+typedef struct {
+	char name[kwMaxLen + 1];
+	char len;
+	char code;
+} Keyword;
+const Keyword kwTable[16] = {
+	[0] = {"END", 3, 'e'},
+	[2] = {"ENDIF", 5, 'e'},
+	[3] = {"IF", 2, 'i'},
+	[4] = {"WRITE", 5, 'W'},
+	[5] = {"ENDWHILE", 8, 'e'},
+	[9] = {"ELSE", 4, 'l'},
+	[10] = {"READ", 4, 'R'},
+	[11] = {"BEGIN", 5, 'b'},
+	[12] = {"WHILE", 5, 'w'},
+	[13] = {"VAR", 3, 'v'},
+	[15] = {"PROGRAM", 7, 'p'},
+};
 
 //Report an error
-void error(char *err) {
-	fprintf(stderr, "Error: %s.\n", err);
+//Messages are prefixed with the file name when compiling a batch
+void error(Compiler *c, char *err) {
+	if (c->name)
+		fprintf(stderr, "%s: Error: %s.\n", c->name, err);
+	else
+		fprintf(stderr, "Error: %s.\n", err);
 }
 
-//Report error and halt
-void fail(char *err, ...) {
+//Report error and abandon the compilation
+//Control returns to compile(), which cleans up and reports failure
+void fail(Compiler *c, char *err, ...) {
 	char errstr[errbufsize];
 	va_list args;
 	va_start(args, err);
 	vsnprintf(errstr, errbufsize, err, args);
-	error(errstr);
 	va_end(args);
-	abort();
+	abandonOutput(&c->out);
+	if (c->tokenPos >= 0) {
+		//Errors found while parsing say where
+		int len = strlen(errstr);
+		snprintf(errstr + len, errbufsize - len, " at line %d", sourceLine(&c->src, c->toks.t[c->tokenPos].offset));
+	}
+	error(c, errstr);
+	longjmp(c->failed, 1);
 }
 
-//Read new character from input stream
-void getChar() {
-	look = getchar();
-	if (ferror(stdin))
-		fail("Error reading stdin");
-	if (feof(stdin))
-		error("EOF on stdin");
+//Advance to the next token
+static inline void nextToken(Compiler *c) {
+	if (TK_EOF != c->look) {
+		c->look = c->toks.t[++c->tokenPos].kind;
+		if (TK_EOF == c->look)
+			error(c, "EOF on input");
+	}
 }
 
 //Generate a Unique lable
-//Copy the label into theLabel
-//Returns pointer to new label
-char *newLabel(char *theLabel) {
-	snprintf(theLabel, labelbufsize, "L%05d", labelCount++);
-	return theLabel;
+//Returns the new label's ID
+int newLabel(Compiler *c) {
+	return c->labelCount++;
 }
 
 //Post a label and comment to output
-void postLabel(char *theLabel, char *comment) {
-	printf("%s:\t%s\n", theLabel, comment);
+void postLabel(Compiler *c, int theLabel, int comment) {
+	gen(&c->code, OP_LABEL, label(theLabel), note(comment));
 }
 
 //Report what was expected and halt
-void expected(char *s) {
-	fail("%s Expected", s);
+void expected(Compiler *c, char *s) {
+	fail(c, "%s Expected", s);
 }
 
 //Report an undefined identifier
-void undefined(char *name) {
-	fail("Undefined identifier: %s", name);
-}
-
-//Recognize an Alpha character
-#define isAlpha(c) isalpha(c)
-
-//Recognize a decimal digit
-#define isDigit(c) isdigit(c)
-
-//Recognize alphanumeric character
-#define isAlNum(c) isalnum(c)
-
-//Recognize whitespace
-int isWhite(char c) {
-	return ' '==c || '\t'==c;
-}
-
-//Recognize EOL
-int isEOL(char c) {
-	return CR==c || LF==c;
-}
-
-//Recognize an Addop
-int isAddop(char c) {
-	return '+'==c || '-'==c;
+void undefined(Compiler *c, const char *name) {
+	fail(c, "Undefined identifier: %s", name);
 }
 
-//Recognize a Mulop
-int isMulop(char c) {
-	return '*'==c || '/'==c;
-}
-
-//Recognize a Boolean Orop
-int isOrop(char c) {
-	return '|'==c || '~'==c;
-}
-
-//Recognize a Relop (relational operation)
-int isRelop(char c) {
-	return strchr("=#<>", c) != NULL;
-}
-
-//Table lookup
-//If the input string matches a table entry, return the
-//  entry index. If not, return -1
-//  A NULL pointer in the table represents the end of the table
-int lookup(char *tab[], char *s, int tableLength) {
-	int found = 0;
-	int i = -1;
-	while (!found && ++i<tableLength) {
-		if (NULL == tab[i]) {
-			//End of table. Search is unsuccessful.
-			i = -1;
-			break;
-		}
-		else {
-			found = (0 == strcmp(tab[i], s));
-		}
-	}
-	if (i >= tableLength) i = -1;
-	return i;
+//Keyword lookup
+//If the string is a keyword, return its token code. If not, return 'x'
+char kwLookup(const char *s, int len) {
+	const Keyword *kw;
+	if ((unsigned)(len - kwMinLen) > kwMaxLen - kwMinLen)
+		return 'x';
+	kw = &kwTable[kwHash(s, len)];
+	if (kw->len != len || 0 != memcmp(kw->name, s, len))
+		return 'x';
+	return kw->code;
 }
 
 //Look for Symbol in Table
-int inTable(char *symbol) {
-	return -1 != lookup(symbolTable, symbol, maxSymbols);
+int inTable(Compiler *c, int id) {
+	return ' ' != c->syms.table[id].type;
 }
 
 //Add a new entry to symbol table
-void addEntry(char *symbol, char symType) {
-	if (inTable(symbol)) {
-		fail("Duplicate Identifier: %s", symbol);
-	}
-	if (symbolCount >= maxSymbols) {
-		fail("Symbol Table Full");
+void addEntry(Compiler *c, int id, char symType) {
+	if (inTable(c, id)) {
+		fail(c, "Duplicate Identifier: %s", c->syms.table[id].name);
 	}
-	symbolTable[symbolCount] = malloc(strlen(symbol)+1); //Allocate memory for the symbol
-	strcpy(symbolTable[symbolCount], symbol); //Copy the symbol into the array
-	symbolType[symbolCount] = symType;
-	symbolCount++;
+	c->syms.table[id].type = symType;
 }
 
-//Skip leading white space
-void skipWhite() {
-	while (isWhite(look))
-		getChar();
-}
-
-//Skip over multiple end-of-lines
-void newLine() {
-	while (isEOL(look)) {
-		getChar();
-		skipWhite();
-	}
+//Skip over an end-of-line
+//The lexer has already folded runs of end-of-lines into one token
+void newLine(Compiler *c) {
+	if (TK_EOL == c->look)
+		nextToken(c);
 }
 
 //Match a specific input character
-void match(char c) {
+void match(Compiler *c, char ch) {
 	char err[4] = {"' '"};
-	newLine();
-	if (look == c)
-		getChar();
+	newLine(c);
+	if (c->look == ch)
+		nextToken(c);
 	else {
-		err[1] = c;
-		expected(err);
+		err[1] = ch;
+		expected(c, err);
 	}
-	skipWhite();
 }
 
 //Match a specific input string
-void matchString(char *s) {
-	if (!(0 == strcmp(value, s))) {
-		expected(s);
+void matchString(Compiler *c, char *s) {
+	if (!(0 == strcmp(c->value, s))) {
+		expected(c, s);
 	}
 }
 
 //Get an identifier
-char *getName() {
-	int bufInx = 0; //index into "value" string
-	newLine();
-	if (!isAlpha(look))
-		expected("Name");
-	while (isAlNum(look) && bufInx < tokenbuflen - 1) {
-		value[bufInx++] = toupper(look);
-		getChar();
-	}
-	value[bufInx] = 0x00; //Terminate the string
-	if (isAlNum(look))
-		fail("Name exceeds maximum length");
-	skipWhite();	
-	return value;
+//Returns its symbol ID
+int getName(Compiler *c) {
+	newLine(c);
+	if (TK_NAME != c->look)
+		expected(c, "Name");
+	c->valueId = c->toks.t[c->tokenPos].value;
+	c->value = c->syms.table[c->valueId].name;
+	nextToken(c);
+	return c->valueId;
 }
 
 //Get a number
-int getNum() {
-	int retval = 0;
-	newLine();
-	if (!isDigit(look))
-		expected("Integer");
-	while (isDigit(look)) {
-		retval = 10 * retval + look - '0';
-		getChar();
-	}
-	skipWhite();
+int getNum(Compiler *c) {
+	int retval;
+	newLine(c);
+	if (TK_NUM != c->look)
+		expected(c, "Integer");
+	retval = c->toks.t[c->tokenPos].value;
+	nextToken(c);
 	return retval;
 }
 
 //Get an identifier and scan it for keywords
-void scan() {
-	getName();
-	token = kwCode[lookup(kwList, value, kwCount) + 1];
+void scan(Compiler *c) {
+	Symbol *sym;
+	getName(c);
+	sym = &c->syms.table[c->valueId];
+	if (0 == sym->token)
+		sym->token = kwLookup(sym->name, sym->len);
+	c->token = sym->token;
 }
 
 //Output a string with a leading tab
-void emit(char *s) {
-	printf("\t%s", s);
+void emit(Compiler *c, char *s) {
+	outChar(&c->out, '\t');
+	outStr(&c->out, s);
 }
 
 //Output a printf-style formatted string and arguments with tab and newline
-void emitln(char *s, ...) {
+void emitln(Compiler *c, char *s, ...) {
 	va_list args;
 	va_start(args, s);
-	printf("\t");
-	vprintf(s, args);
-	printf("\n");
+	outChar(&c->out, '\t');
+	outvf(&c->out, s, args);
+	outChar(&c->out, '\n');
 	va_end(args);
 }
 
@@ -251,186 +215,191 @@ void emitln(char *s, ...) {
 //
 
 //Complement the primary register
-void notIt() {
-	emitln("not\t%%eax");
+void notIt(Compiler *c) {
+	gen(&c->code, OP_NOT, reg(R_AX), none);
 }
 
 //Clear the primary register
-void clear() {
-	emitln("mov\t$0,%%eax");
+void clear(Compiler *c) {
+	gen(&c->code, OP_MOV, imm(0), reg(R_AX));
 }
 
 //Negate the primary register
-void negate() {
-	emitln("neg\t%%eax");
+void negate(Compiler *c) {
+	gen(&c->code, OP_NEG, reg(R_AX), none);
 }
 
 //Store primary register to variable
-void store(char *name) {
-	if (!inTable(name)) {
-		undefined(name);
+void store(Compiler *c, int id) {
+	if (!inTable(c, id)) {
+		undefined(c, c->syms.table[id].name);
 	}
-	emitln("mov\t%%eax,%s", name);
+	gen(&c->code, OP_MOV, reg(R_AX), raOperand(&c->ra, id));
 }
 
 //Load a constant value to the primary register
-void loadConst(int n) {
-	emitln("mov\t$%d,%%eax", n);
+void loadConst(Compiler *c, int n) {
+	gen(&c->code, OP_MOV, imm(n), reg(R_AX));
 }
 
 //Load a variable to the primary register
-void loadVar(char *name) {
-	if (!inTable(name)) {
-		undefined(name);
+void loadVar(Compiler *c, int id) {
+	if (!inTable(c, id)) {
+		undefined(c, c->syms.table[id].name);
 	}
-	emitln("mov\t%s,%%eax", name);
+	gen(&c->code, OP_MOV, raOperand(&c->ra, id), reg(R_AX));
 }
 
-//Read a variable (whose name is in value variable) into the primary register
-void readVar() {
-	emitln("call\t_readIobuf");
-	emitln("call\t_convertFromAscii");
-	store(value);
+//Read a variable
+void readVar(Compiler *c, int id) {
+	raSave(&c->ra, &c->code);
+	gen(&c->code, OP_CALL, func(FN_READIOBUF), none);
+	gen(&c->code, OP_CALL, func(FN_CONVERTFROMASCII), none);
+	raRestore(&c->ra, &c->code);
+	store(c, id);
 }
 
 //Write value in primary register
-void writeVar() {
-	emitln("call\t_convertToAscii");
-	emitln("call\t_writeIobuf");
+void writeVar(Compiler *c) {
+	raSave(&c->ra, &c->code);
+	gen(&c->code, OP_CALL, func(FN_CONVERTTOASCII), none);
+	gen(&c->code, OP_CALL, func(FN_WRITEIOBUF), none);
+	raRestore(&c->ra, &c->code);
 }
 
 //Push primary register onto stack
-void push() {
-	emitln("push\t%%eax");
+void push(Compiler *c) {
+	gen(&c->code, OP_PUSH, reg(R_AX), none);
 }
 
 //AND top of stack with primary register
-void popAnd() {
-	emitln("pop\t%%ebx"); //pop top of stack to ebx
-	emitln("and\t%%ebx,%%eax"); //and ebx to eax
+void popAnd(Compiler *c) {
+	gen(&c->code, OP_POP, reg(R_BX), none); //pop top of stack to ebx
+	gen(&c->code, OP_AND, reg(R_BX), reg(R_AX)); //and ebx to eax
 }
 
 //OR top of stack with primary register
-void popOr() {
-	emitln("pop\t%%ebx"); //pop top of stack to ebx
-	emitln("or\t%%ebx,%%eax"); //or ebx to eax
+void popOr(Compiler *c) {
+	gen(&c->code, OP_POP, reg(R_BX), none); //pop top of stack to ebx
+	gen(&c->code, OP_OR, reg(R_BX), reg(R_AX)); //or ebx to eax
 }
 
 //XOR top of stack with primary register
-void popXor() {
-	emitln("pop\t%%ebx"); //pop top of stack to ebx
-	emitln("xor\t%%ebx,%%eax"); //xor ebx to eax
+void popXor(Compiler *c) {
+	gen(&c->code, OP_POP, reg(R_BX), none); //pop top of stack to ebx
+	gen(&c->code, OP_XOR, reg(R_BX), reg(R_AX)); //xor ebx to eax
 }
 
 //Compare top of stack with primary
-void popCompare() {
-	emitln("pop\t%%ebx"); //pop top of stack to ebx
-	emitln("cmp\t%%eax,%%ebx"); //compare ebx with eax
+void popCompare(Compiler *c) {
+	gen(&c->code, OP_POP, reg(R_BX), none); //pop top of stack to ebx
+	gen(&c->code, OP_CMP, reg(R_AX), reg(R_BX)); //compare ebx with eax
 	//Keep in mind that in AT&T syntax, cmp looks backward
 	//jg will jump if ebx>eax
 }
 
-//Set eax if compare was =
-void setEqual() {
-	emitln("sete\t%%al");
-	emitln("neg\t%%al\t#change 1 to -1"); //TRUE is -1 in this language
-	emitln("movsx\t%%al,%%eax\t#extend al to eax");
-}
-
-//Set eax if compare was !=
-void setNEqual() {
-	emitln("setne\t%%al");
-	emitln("neg\t%%al\t#change 1 to -1"); //TRUE is -1 in this language
-	emitln("movsx\t%%al,%%eax\t#extend al to eax");
-}
-
-//Set eax if compare was >
-void setGreater() {
-	emitln("setg\t%%al");
-	emitln("neg\t%%al\t#change 1 to -1"); //TRUE is -1 in this language
-	emitln("movsx\t%%al,%%eax\t#extend al to eax");
-}
-
-//Set eax if compare was >=
-void setGreaterOrEqual() {
-	emitln("setge\t%%al");
-	emitln("neg\t%%al\t#change 1 to -1"); //TRUE is -1 in this language
-	emitln("movsx\t%%al,%%eax\t#extend al to eax");
-}
-
-//Set eax if compare was <
-void setLess() {
-	emitln("setl\t%%al");
-	emitln("neg\t%%al\t#change 1 to -1"); //TRUE is -1 in this language
-	emitln("movsx\t%%al,%%eax\t#extend al to eax");
-}
-
-//Set eax if compare was <=
-void setLessOrEqual() {
-	emitln("setle\t%%al");
-	emitln("neg\t%%al\t#change 1 to -1"); //TRUE is -1 in this language
-	emitln("movsx\t%%al,%%eax\t#extend al to eax");
+//Set eax to TRUE (-1) or FALSE (0) from a condition code
+void setCond(Compiler *c, int cond) {
+	genCond(&c->code, OP_SET, cond, reg8(R_AX));
+	gen(&c->code, OP_NEG, reg8(R_AX), none); //TRUE is -1 in this language
+	gen(&c->code, OP_MOVSX, reg8(R_AX), reg(R_AX));
 }
 
 //Add top of stack to primary register
-void popAdd() {
-	emitln("pop\t%%ebx"); //pop top of stack to ebx
-	emitln("add\t%%ebx,%%eax"); //add ebx to eax
+void popAdd(Compiler *c) {
+	gen(&c->code, OP_POP, reg(R_BX), none); //pop top of stack to ebx
+	gen(&c->code, OP_ADD, reg(R_BX), reg(R_AX)); //add ebx to eax
 }
 
 //Subtract primary register from top of stack
-void popSub() {
-	emitln("pop\t%%ebx"); //pop first operand to ebx
-	emitln("sub\t%%ebx,%%eax"); //subtract ebx from eax
-	emitln("neg\t%%eax"); //negate eax to fix sign error
+void popSub(Compiler *c) {
+	gen(&c->code, OP_POP, reg(R_BX), none); //pop first operand to ebx
+	gen(&c->code, OP_SUB, reg(R_BX), reg(R_AX)); //subtract ebx from eax
+	gen(&c->code, OP_NEG, reg(R_AX), none); //negate eax to fix sign error
 }
 
 //Multiply top of stack by primary register
-void popMul() {
-	emitln("pop\t%%ebx"); //pop top of stack to ebx
-	emitln("mul\t%%ebx"); //multiply eax by ebx
+void popMul(Compiler *c) {
+	gen(&c->code, OP_POP, reg(R_BX), none); //pop top of stack to ebx
+	gen(&c->code, OP_MUL, reg(R_BX), none); //multiply eax by ebx
 }
 
 //Divide top of stack by primary register
-void popDiv() {
-	emitln("mov\t%%eax,%%ebx"); //move second factor to ebx
-	emitln("pop\t%%eax"); //pop first factor into eax
-	emitln("xor\t%%edx,%%edx"); //clear high word of dividend
-	emitln("div\t%%ebx"); //divide first factor by second factor
+void popDiv(Compiler *c) {
+	gen(&c->code, OP_MOV, reg(R_AX), reg(R_BX)); //move second factor to ebx
+	gen(&c->code, OP_POP, reg(R_AX), none); //pop first factor into eax
+	gen(&c->code, OP_XOR, reg(R_DX), reg(R_DX)); //clear high word of dividend
+	gen(&c->code, OP_DIV, reg(R_BX), none); //divide first factor by second factor
 }
 
 //Branch unconditional
-void branch(char *label) {
-	emitln("jmp\t%s", label);
+void branch(Compiler *c, int theLabel) {
+	gen(&c->code, OP_JMP, label(theLabel), none);
 }
 
 //Branch false
-void branchFalse(char *label) {
-	emitln("test\t%%eax,%%eax");
-	emitln("je\t%s", label);
+void branchFalse(Compiler *c, int theLabel) {
+	gen(&c->code, OP_TEST, reg(R_AX), reg(R_AX));
+	genCond(&c->code, OP_JCC, CC_E, label(theLabel));
+}
+
+//Print or assemble the instructions generated so far
+void emitCode(Compiler *c) {
+	if (FORMAT_ASM == c->opt.format)
+		printCode(&c->code, &c->syms, &c->out);
+	else
+		encodeCode(&c->obj, &c->code);
 }
 
-void header() {
+//Emit the instructions generated so far, running the peephole optimizer over them first with -O
+void flushCode(Compiler *c) {
+	if (c->opt.optimize)
+		peephole(&c->code, 0, c->peepApplied);
+	emitCode(c);
+}
+
+void header(Compiler *c) {
+	if (FORMAT_VM == c->opt.format)
+		return;
+	if (FORMAT_ASM != c->opt.format) {
+		objStart(&c->obj, c->opt.format);
+		return;
+	}
 #ifdef RELEASE
-	asmheader();
+	asmheader(&c->out, c->opt.target);
 #else
-	emitln("HEADER");
+	emitln(c, "HEADER");
 #endif
 }
 
-void prolog() {
+void prolog(Compiler *c) {
+	if (FORMAT_VM == c->opt.format)
+		return;
+	if (FORMAT_ASM != c->opt.format) {
+		objProlog(&c->obj, FORMAT_RUN == c->opt.format ? jitHelper : NULL);
+		return;
+	}
 #ifdef RELEASE
-	asmprolog();
+	asmprolog(&c->out, c->opt.target);
 #else
-	emitln("PROLOG");
+	emitln(c, "PROLOG");
 #endif
 }
 
-void epilog() {
+void epilog(Compiler *c) {
+	if (FORMAT_VM == c->opt.format)
+		return;
+	flushCode(c);
+	if (FORMAT_ASM != c->opt.format) {
+		objEnd(&c->obj);
+		if (FORMAT_RUN != c->opt.format)
+			writeElf(&c->obj, &c->syms, &c->out);
+		return;
+	}
 #ifdef RELEASE
-	asmepilog();
+	asmepilog(&c->out, c->opt.target);
 #else
-	emitln("EPILOG");
+	emitln(c, "EPILOG");
 #endif
 }
 
@@ -439,447 +408,1218 @@ void epilog() {
 //
 
 //Allocate storage for a variable
-void alloc(char *name) {
-	if (inTable(name)) {
-		fail("Duplicate variable name: %s", name);
-	}
-	addEntry(name, 'v');
-	printf("%s:\t", name);
-	if ('=' == look) {
-		match('=');
-		printf(".long ");
+void alloc(Compiler *c, int id) {
+	int neg, n;
+	if (inTable(c, id)) {
+		fail(c, "Duplicate variable name: %s", c->syms.table[id].name);
+	}
+	addEntry(c, id, 'v');
+	if (FORMAT_ASM != c->opt.format) {
+		if ('=' == c->look) {
+			match(c, '=');
+			neg = '-' == c->look;
+			if (neg)
+				match(c, '-');
+			n = getNum(c);
+			if (FORMAT_VM == c->opt.format)
+				vmVar(&c->vm, id, neg ? -n : n);
+			else
+				objVar(&c->obj, id, neg ? -n : n);
+		}
+		else if (FORMAT_VM != c->opt.format)
+			objVar(&c->obj, id, 0);
+		return;
+	}
+	outStr(&c->out, c->syms.table[id].name);
+	outBytes(&c->out, ":\t", 2);
+	if ('=' == c->look) {
+		match(c, '=');
+		outStr(&c->out, ".long ");
 		//Allocate a 4-byte variable with the specified value
-		if ('-' == look) {
-			printf("-");
-			match('-');
+		if ('-' == c->look) {
+			outChar(&c->out, '-');
+			match(c, '-');
 		}
-		printf("%d\n", getNum());
+		outf(&c->out, "%d\n", getNum(c));
 	}
 	else {
 		//Allocate uninitialized space
-		printf(".space 4\n");
+		outStr(&c->out, ".space 4\n");
 	}
 }
 
-void expression();
-
-//Recognize and Translate a Relation "Equals"
-void equals() {
-	match('=');
-	expression();
-	popCompare();
-	setEqual();
-}
-
-//Recognize and Translate a Relation "Not Equals"
-void notEquals() {
-	match('>');
-	expression();
-	popCompare();
-	setNEqual();
+//
+#pragma mark Expressions
+//
+//Expressions are parsed without recursion. Pending operators wait on an
+//  explicit stack until the next operator has lower or equal precedence;
+//  their operands are on the target's stack, pushed by push() and popped
+//  by the popXxx() routines.
+
+//Operator precedence, lowest to highest
+enum { P_NONE, P_OR, P_AND, P_NOT, P_REL, P_ADD, P_MUL };
+
+//Precedence of each binary operator token; P_NONE ends an expression
+const unsigned char opPrec[128] = {
+	['|'] = P_OR, ['~'] = P_OR,
+	['&'] = P_AND,
+	['='] = P_REL, ['#'] = P_REL, ['<'] = P_REL, ['>'] = P_REL,
+	['+'] = P_ADD, ['-'] = P_ADD,
+	['*'] = P_MUL, ['/'] = P_MUL,
+};
+
+//Where the next operand starts
+enum {
+	S_BOOL, //A Boolean factor, which may start with NOT
+	S_EXPR, //An expression, which may start with a sign
+	S_FACTOR, //A plain factor
+	S_DONE //The expression is complete
+};
+
+//Push a pending operator
+void pushOp(Compiler *c, char op, char prec, char cond, char neg) {
+	PendingOp *p;
+	if (c->opCount == c->opCapacity) {
+		c->opCapacity = c->opCapacity ? 2 * c->opCapacity : 64;
+		c->ops = realloc(c->ops, c->opCapacity * sizeof(PendingOp));
+		if (NULL == c->ops)
+			abort();
+	}
+	p = &c->ops[c->opCount++];
+	p->op = op;
+	p->prec = prec;
+	p->cond = cond;
+	p->neg = neg;
+}
+
+//Push a value onto the operand stack
+void pushVal(Compiler *c, int n) {
+	if (c->valCount == c->valCapacity) {
+		c->valCapacity = c->valCapacity ? 2 * c->valCapacity : 64;
+		c->vals = realloc(c->vals, c->valCapacity * sizeof(int));
+		if (NULL == c->vals)
+			abort();
+	}
+	c->vals[c->valCount++] = n;
 }
 
-//Recognize and Translate a Relation "Less Than or Equal"
-void lessOrEqual() {
-	match('=');
-	expression();
-	popCompare();
-	setLessOrEqual();
+//Pop a value from the operand stack
+static inline int popVal(Compiler *c) {
+	return c->vals[--c->valCount];
 }
 
-//Recognize and Translate a Relation "Less Than"
-void less() {
-	match('<');
-	switch (look) {
-		case '=':
-			lessOrEqual();
+//Generate the code that applies an operator to the top of stack and the primary register
+void genOperator(Compiler *c, int op, int cond) {
+	switch (op) {
+		case '|':
+			popOr(c);
 			break;
-		case '>':
-			notEquals();
+		case '~':
+			popXor(c);
+			break;
+		case '&':
+			popAnd(c);
+			break;
+		case '!':
+			notIt(c);
+			break;
+		case '+':
+			popAdd(c);
+			break;
+		case '-':
+			popSub(c);
+			break;
+		case '*':
+			popMul(c);
+			break;
+		case '/':
+			popDiv(c);
 			break;
 		default:
-			expression();
-			popCompare();
-			setLess();
+			popCompare(c);
+			setCond(c, cond);
 			break;
 	}
 }
 
-//Recognize and Translate a Relation "Greater Than"
-void greater() {
-	match('>');
-	if ('=' == look) {
-		match('=');
-		expression();
-		popCompare();
-		setGreaterOrEqual();
+//Apply a pending operator
+//  With -O it becomes a tree node over the finished operands, folded to a
+//  number when they are numbers; otherwise its code is generated
+void reduce(Compiler *c, const PendingOp *p) {
+	if (c->opt.optimize) {
+		if ('!' == p->op)
+			pushVal(c, astFoldUnary(&c->ast, N_NOT, popVal(c)));
+		else {
+			int right = popVal(c);
+			int left = popVal(c);
+			pushVal(c, astFoldBinary(&c->ast, p->op, p->cond, left, right));
+		}
 	}
-	else {
-		expression();
-		popCompare();
-		setGreater();
+	else
+		genOperator(c, p->op, p->cond);
+}
+
+//Finish an operand: a number, a variable or a negated operand
+void operandConst(Compiler *c, int n) {
+	if (c->opt.optimize)
+		pushVal(c, astLeaf(&c->ast, N_NUM, n));
+	else
+		loadConst(c, n);
+}
+
+void operandVar(Compiler *c, int id) {
+	if (c->opt.optimize) {
+		if (!inTable(c, id)) {
+			undefined(c, c->syms.table[id].name);
+		}
+		pushVal(c, astLeaf(&c->ast, N_VAR, id));
 	}
+	else
+		loadVar(c, id);
 }
 
-//Recognize and Translate a Relation "Greater Than or Equal"
-void greaterOrEqual() {
-	match('=');
-	expression();
-	popCompare();
-	setGreaterOrEqual();
+void operandNeg(Compiler *c) {
+	if (c->opt.optimize)
+		pushVal(c, astFoldUnary(&c->ast, N_NEG, popVal(c)));
+	else
+		negate(c);
 }
 
-//Parse and translate a Relation
-void relation() {
-	expression();
-	if (isRelop(look)) {
-		push();
-		switch (look) {
+//Parse and translate an operand
+//  Returns 1 when the operand is complete, 0 if it opened a parenthesis
+int operand(Compiler *c, int state) {
+	int neg = 0;
+	if (S_BOOL == state && '!' == c->look) {
+		match(c, '!');
+		pushOp(c, '!', P_NOT, 0, 0);
+	}
+	if (S_FACTOR != state) {
+		//Only the first factor of an expression can have a sign
+		newLine(c);
+		if ('+' == c->look) {
+			match(c, '+');
+		}
+		else if ('-' == c->look) {
+			match(c, '-');
+			if (TK_NUM == c->look) {
+				operandConst(c, -getNum(c));
+				return 1;
+			}
+			neg = 1;
+		}
+	}
+	if ('(' == c->look) {
+		match(c, '(');
+		pushOp(c, '(', P_NONE, 0, neg);
+		return 0;
+	}
+	if (TK_NAME == c->look) {
+		operandVar(c, getName(c));
+	}
+	else {
+		operandConst(c, getNum(c));
+	}
+	if (neg) {
+		operandNeg(c);
+	}
+	return 1;
+}
+
+//Parse and translate what follows an operand: reduce pending operators,
+//  close parentheses, and push the next binary operator
+//  floor is the lowest precedence the expression accepts outside parentheses
+//  Returns where the next operand starts, or S_DONE
+int afterOperand(Compiler *c, int floor, int *depth) {
+	int noMul = 0;
+	for (;;) {
+		int prec = opPrec[c->look];
+		int lineBreak = 0;
+		char cond = 0;
+		if (P_MUL == prec && noMul)
+			prec = P_NONE; //A mulop on the line after an addop term ends the expression
+		while (!lineBreak && c->opCount > 0 && '(' != c->ops[c->opCount - 1].op && c->ops[c->opCount - 1].prec >= prec) {
+			PendingOp *top = &c->ops[--c->opCount];
+			if (P_REL == prec && P_REL == top->prec)
+				prec = P_NONE; //Relations do not associate
+			reduce(c, top);
+			lineBreak = P_ADD == top->prec && TK_EOL == c->look;
+		}
+		if (lineBreak) {
+			//An addop term may be followed by a line break
+			newLine(c);
+			noMul = 1;
+			continue;
+		}
+		if (prec < (*depth ? P_OR : floor)) {
+			if (0 == *depth)
+				return S_DONE;
+			match(c, ')');
+			(*depth)--;
+			if (c->ops[--c->opCount].neg) {
+				operandNeg(c);
+			}
+			noMul = 0;
+			continue;
+		}
+		
+		if (!c->opt.optimize)
+			push(c);
+		switch (c->look) {
 			case '=':
-				equals();
+				match(c, '=');
+				cond = CC_E;
 				break;
 			case '#':
-				notEquals();
+				match(c, '>');
+				cond = CC_NE;
 				break;
 			case '<':
-				less();
+				match(c, '<');
+				if ('=' == c->look) {
+					match(c, '=');
+					cond = CC_LE;
+				}
+				else if ('>' == c->look) {
+					match(c, '>');
+					cond = CC_NE;
+				}
+				else
+					cond = CC_L;
 				break;
 			case '>':
-				greater();
+				match(c, '>');
+				if ('=' == c->look) {
+					match(c, '=');
+					cond = CC_GE;
+				}
+				else
+					cond = CC_G;
 				break;
+			default:
+				pushOp(c, c->look, prec, 0, 0);
+				match(c, c->look);
+				return prec >= P_ADD ? S_FACTOR : S_BOOL;
 		}
+		pushOp(c, '=', P_REL, cond, 0);
+		return S_EXPR;
 	}
 }
 
-//Parse and translate a Boolean factor with leading NOT
-void notFactor() {
-	if ('!'==look) {
-		match('!');
-		relation();
-		notIt();
-	}
-	else {
-		relation();
+//Parse and translate an expression
+//  floor is P_OR for a Boolean expression, P_ADD for a math expression
+void parseExpr(Compiler *c, int floor) {
+	int state = P_OR == floor ? S_BOOL : S_EXPR;
+	int depth = 0;
+	while (S_DONE != state) {
+		while (!operand(c, state)) {
+			depth++;
+			state = S_BOOL;
+		}
+		state = afterOperand(c, floor, &depth);
 	}
 }
 
-//Parse and translate a Boolean term
-void boolTerm() {
-	notFactor();
-	while ('&'==look) {
-		push();
-		match('&');
-		notFactor();
-		popAnd();
-	}
+//Parse and translate a Boolean expression
+void boolExpression(Compiler *c) {
+	parseExpr(c, P_OR);
 }
 
-//Recognize and translate a Boolean OR
-void boolOr() {
-	match('|');
-	boolTerm();
-	popOr();
+//Parse and translate a math expression
+void expression(Compiler *c) {
+	parseExpr(c, P_ADD);
 }
 
-//Recognize and translate a Boolean XOR
-void boolXor() {
-	match('~');
-	boolTerm();
-	popXor();
+//Process a Data Declaration
+void decl(Compiler *c) {
+	alloc(c, getName(c));
+	while (',' == c->look) {
+		match(c, ',');
+		alloc(c, getName(c));
+	}
 }
 
-//Parse and translate a Boolean expression
-void boolExpression() {
-	boolTerm();
-	while (isOrop(look)) {
-		push();
-		switch (look) {
-			case '|':
-				boolOr();
+//Parse and translage Global Declarations
+void topDecls(Compiler *c) {
+	scan(c);
+	while ('b' != c->token) {
+		switch (c->token) {
+			case 'v':
+				decl(c);
 				break;
-			case '~':
-				boolXor();
+			default:
+				fail(c, "Unrecognized keyword: %s", c->value);
 				break;
 		}
+		scan(c);
 	}
 }
 
-//Parse and translate a math factor
-void factor() {
-	if ('(' == look) {
-		match('(');
-		boolExpression();
-		match(')');
-	}
-	else if (isAlpha(look)) {
-		loadVar(getName());
+//Parse and translate an Assignment statement
+//Statements return their tree node with -O, 0 otherwise
+int assignment(Compiler *c) {
+	int id = c->valueId;
+	match(c, '=');
+	boolExpression(c);
+	if (c->opt.optimize) {
+		if (!inTable(c, id)) {
+			undefined(c, c->syms.table[id].name);
+		}
+		return astAssign(&c->ast, id, popVal(c));
 	}
-	else {
-		loadConst(getNum());
+	store(c, id);
+	return 0;
+}
+
+int block(Compiler *c);
+
+//Add a statement to the end of a list
+//  first and last are the list's first and last statements
+void append(Compiler *c, int *first, int *last, int n) {
+	if (0 == n)
+		return;
+	if (0 == *first)
+		*first = n;
+	else
+		astNext(&c->ast, *last) = n;
+	*last = n;
+}
+
+//Read one variable
+int readOne(Compiler *c) {
+	getName(c);
+	if (c->opt.optimize) {
+		if (!inTable(c, c->valueId)) {
+			undefined(c, c->syms.table[c->valueId].name);
+		}
+		return astRead(&c->ast, c->valueId);
 	}
+	readVar(c, c->valueId);
+	return 0;
 }
 
-//Parse and translate a negative factor
-void negFactor() {
-	match('-');
-	if (isDigit(look)) {
-		loadConst(-getNum());
+//Process a Read statement
+int doRead(Compiler *c) {
+	int first = 0;
+	int last = 0;
+	match(c, '(');
+	append(c, &first, &last, readOne(c));
+	while (',' == c->look) {
+		match(c, ',');
+		append(c, &first, &last, readOne(c));
 	}
-	else {
-		factor();
-		negate();
+	match(c, ')');
+	return first;
+}
+
+//Write one expression
+int writeOne(Compiler *c) {
+	expression(c);
+	if (c->opt.optimize)
+		return astWrite(&c->ast, popVal(c));
+	writeVar(c);
+	return 0;
+}
+
+int doWrite(Compiler *c) {
+	int first = 0;
+	int last = 0;
+	match(c, '(');
+	append(c, &first, &last, writeOne(c));
+	while (',' == c->look) {
+		match(c, ',');
+		append(c, &first, &last, writeOne(c));
 	}
+	match(c, ')');
+	return first;
 }
+	
 
-//Parse and translate a leading factor
-void firstFactor() {
-	switch (look) {
-		case '+':
-			match('+');
-			factor();
-			break;
-		case '-':
-			negFactor();
-			break;
-		default:
-			factor();
-			break;
+//Recognize and translate an IF construct
+int doIf(Compiler *c) {
+	int label1, label2;
+	
+	if (c->opt.optimize) {
+		int cond, thenPart, elsePart = 0;
+		int hasElse = 0;
+		boolExpression(c);
+		cond = popVal(c);
+		thenPart = block(c);
+		if ('l' == c->token) {
+			hasElse = 1;
+			elsePart = block(c);
+		}
+		matchString(c, "ENDIF");
+		return astIf(&c->ast, cond, thenPart, elsePart, hasElse);
 	}
+	
+	label1 = newLabel(c);
+	label2 = label1;
+	gen(&c->code, OP_COMMENT, note(NOTE_IF), none);
+	boolExpression(c);
+	branchFalse(c, label1);
+	block(c);
+	if ('l' == c->token) {
+		label2 = newLabel(c);
+		branch(c, label2);
+		postLabel(c, label1, NOTE_ELSE);
+		block(c);
+	}
+	postLabel(c, label2, NOTE_ENDIF);
+	matchString(c, "ENDIF");
+	return 0;
 }
 
-//Recognize and translate a multiply
-void multiply() {
-	match('*');
-	factor();
-	popMul();
-}
-
-//Recognize and translate a divide
-void divide() {
-	match('/');
-	factor();
-	popDiv();
-}
-
-//Process a Data Declaration
-void decl() {
-	alloc(getName());
-	while (',' == look) {
-		match(',');
-		alloc(getName());
+//Recognize and translate a while statement
+int doWhile(Compiler *c) {
+	int label1, label2;
+	
+	if (c->opt.optimize) {
+		int cond, body;
+		boolExpression(c);
+		cond = popVal(c);
+		body = block(c);
+		matchString(c, "ENDWHILE");
+		return astWhile(&c->ast, cond, body);
 	}
+	
+	label1 = newLabel(c);
+	label2 = newLabel(c);
+	postLabel(c, label1, NOTE_WHILE);
+	boolExpression(c);
+	branchFalse(c, label2);
+	block(c);
+	matchString(c, "ENDWHILE");
+	branch(c, label1);
+	postLabel(c, label2, NOTE_ENDWHILE);
+	return 0;
 }
 
-//Parse and translage Global Declarations
-void topDecls() {
-	scan();
-	while ('b' != token) {
-		switch (token) {
-			case 'v':
-				decl();
+//Parse and translate a Block of statements
+//Returns its first statement with -O
+int block(Compiler *c) {
+	int first = 0;
+	int last = 0;
+	int n;
+	scan(c);
+	while ('e' != c->token && 'l' != c->token) {
+		switch (c->token) {
+			case 'i':
+				n = doIf(c);
+				break;
+			case 'w':
+				n = doWhile(c);
+				break;
+			case 'R':
+				n = doRead(c);
+				break;
+			case 'W':
+				n = doWrite(c);
 				break;
 			default:
-				fail("Unrecognized keyword: %s", value);
+				n = assignment(c);
 				break;
 		}
-		scan();
+		if (c->opt.optimize) {
+			//READ and WRITE make a statement per item; find the last one
+			append(c, &first, &last, n);
+			while (0 != last && 0 != astNext(&c->ast, last))
+				last = astNext(&c->ast, last);
+		}
+		else if (c->code.count >= codeFlushCount)
+			emitCode(c); //Statement boundary: keep the instruction stream from growing without bound
+		scan(c);
 	}
+	return first;
 }
 
-//Common code used by term() and firstTerm()
-void term1() {
-	while (isMulop(look)) {
-		push();
-		switch (look) {
-			case '*':
-				multiply();
-				break;
-			case '/':
-				divide();
+//
+#pragma mark Code Generation from the Tree
+//
+
+//Generate stack machine code for an expression tree, leaving its value in the primary register
+//  The tree is walked with an explicit stack, so deep nesting is safe.
+//  Stack entries are a node index times two, plus one once its left operand is done.
+void genStackExpr(Compiler *c, int n) {
+	Ast *t = &c->ast;
+	int base = c->valCount;
+	for (;;) {
+		//Go down the left side of the tree to a leaf
+		while (N_NUM != astKind(t, n) && N_VAR != astKind(t, n)) {
+			pushVal(c, 2 * n);
+			n = astArg(t, n, 0);
+		}
+		if (N_NUM == astKind(t, n))
+			loadConst(c, astArg(t, n, 0));
+		else
+			loadVar(c, astArg(t, n, 0));
+		
+		//Come back up, applying operators, until a right operand is due
+		for (;;) {
+			int top;
+			if (c->valCount == base)
+				return;
+			top = c->vals[c->valCount - 1];
+			n = top / 2;
+			if (N_BINARY == astKind(t, n) && 0 == top % 2) {
+				push(c);
+				c->vals[c->valCount - 1]++;
+				n = astArg(t, n, 1);
 				break;
+			}
+			c->valCount--;
+			switch (astKind(t, n)) {
+				case N_NEG:
+					negate(c);
+					break;
+				case N_NOT:
+					notIt(c);
+					break;
+				default:
+					genOperator(c, astOp(t, n), astCond(t, n));
+					break;
+			}
 		}
 	}
 }
 
-//Parse and translate a math term
-void term() {
-	factor();
-	term1();
+//Registers for expression temporaries, in the order they are handed out
+//  %edx is kept out: mul and div use it, and it holds a spilled operand.
+//  The registers for variables (see regalloc.c) join the pool for
+//  statements where no variable lives in them.
+static const int exprRegs[] = {R_AX, R_BX, R_CX};
+static const int exprRegs64[] = {R_AX, R_BX, R_CX, R_SI, R_DI, R_R11};
+
+//Choose the registers expressions in the current statement may use
+void setRegPool(Compiler *c) {
+	if (TARGET_ELF64 == c->opt.target) {
+		memcpy(c->regPool, exprRegs64, sizeof exprRegs64);
+		c->regPoolSize = sizeof exprRegs64 / sizeof exprRegs64[0];
+	}
+	else {
+		memcpy(c->regPool, exprRegs, sizeof exprRegs);
+		c->regPoolSize = sizeof exprRegs / sizeof exprRegs[0];
+	}
+	c->regPoolSize += raFreeRegs(&c->ra, c->regPool + c->regPoolSize);
 }
 
-//Parse and translate a leading term
-void firstTerm() {
-	firstFactor();
-	term1();
+void genValue(Compiler *c, int n, int k, int depth);
+
+//A number or variable node as an instruction operand
+static Operand leafOperand(Compiler *c, int n) {
+	Ast *t = &c->ast;
+	return N_NUM == astKind(t, n) ? imm(astArg(t, n, 0)) : raOperand(&c->ra, astArg(t, n, 0));
 }
 
-//Recognize and translate an add
-void add() {
-	match('+');
-	term();
-	popAdd();
+static int isLeaf(Ast *t, int n) {
+	return N_NUM == astKind(t, n) || N_VAR == astKind(t, n);
 }
 
-//Recognize and translate a subtract
-void subtract() {
-	match('-');
-	term();
-	popSub();
+//Evaluate both operands of a binary node
+//  The left one ends up in a register, the right one in a register or as a
+//  number or variable operand. One of them is in regPool[k].
+//  The side that needs more registers goes first (Sethi-Ullman order). With
+//  only regPool[k] left, the right side waits on the stack and comes back in %edx.
+static void genOperands(Compiler *c, int n, int k, int depth, Operand *left, Operand *right) {
+	Ast *t = &c->ast;
+	int l = astArg(t, n, 0);
+	int r = astArg(t, n, 1);
+	if (isLeaf(t, r) && ('/' != astOp(t, n) || O_REG == leafOperand(c, r).kind)) {
+		//div takes a register, which a variable may already be in
+		genValue(c, l, k, depth + 1);
+		*left = reg(c->regPool[k]);
+		*right = leafOperand(c, r);
+	}
+	else if (k + 1 == c->regPoolSize) {
+		genValue(c, r, k, depth + 1);
+		gen(&c->code, OP_PUSH, reg(c->regPool[k]), none);
+		genValue(c, l, k, depth + 1);
+		gen(&c->code, OP_POP, reg(R_DX), none);
+		*left = reg(c->regPool[k]);
+		*right = reg(R_DX);
+	}
+	else if (astNeed(t, l) >= astNeed(t, r)) {
+		genValue(c, l, k, depth + 1);
+		genValue(c, r, k + 1, depth + 1);
+		*left = reg(c->regPool[k]);
+		*right = reg(c->regPool[k + 1]);
+	}
+	else {
+		genValue(c, r, k, depth + 1);
+		genValue(c, l, k + 1, depth + 1);
+		*left = reg(c->regPool[k + 1]);
+		*right = reg(c->regPool[k]);
+	}
 }
 
-//Parse and translate an expression
-void expression() {
-	newLine();
-	firstTerm();
-	while (isAddop(look)) {
-		push();
-		switch (look) {
-			case '+':
-				add();
-				break;
-			case '-':
-				subtract();
+//Divide register a by register b, leaving the quotient in regPool[k]
+//  div wants the dividend in %eax and clears nothing for us, so values
+//  living in %eax are swapped out around it.
+static void genDivide(Compiler *c, int a, int b, int k) {
+	Code *code = &c->code;
+	if (R_DX == b) {
+		//A spilled divisor; a is the last register in the pool, not %eax
+		gen(code, OP_PUSH, reg(R_AX), none);
+		gen(code, OP_MOV, reg(a), reg(R_AX));
+		gen(code, OP_MOV, reg(R_DX), reg(a));
+		gen(code, OP_XOR, reg(R_DX), reg(R_DX));
+		gen(code, OP_DIV, reg(a), none);
+		gen(code, OP_MOV, reg(R_AX), reg(a));
+		gen(code, OP_POP, reg(R_AX), none);
+		return;
+	}
+	if (R_AX == a) {
+		gen(code, OP_XOR, reg(R_DX), reg(R_DX));
+		gen(code, OP_DIV, reg(b), none);
+		return;
+	}
+	if (R_AX == b) {
+		//Swap so the dividend is in %eax and the divisor in a
+		gen(code, OP_XCHG, reg(a), reg(R_AX));
+		gen(code, OP_XOR, reg(R_DX), reg(R_DX));
+		gen(code, OP_DIV, reg(a), none);
+		return;
+	}
+	//%eax holds a value still to be used
+	gen(code, OP_XCHG, reg(a), reg(R_AX));
+	gen(code, OP_XOR, reg(R_DX), reg(R_DX));
+	gen(code, OP_DIV, reg(b), none);
+	gen(code, OP_XCHG, reg(a), reg(R_AX));
+	if (a != c->regPool[k])
+		gen(code, OP_MOV, reg(a), reg(b));
+}
+
+//Evaluate a relation's operands and compare them, setting the flags for its condition
+void genCompare(Compiler *c, int n, int k, int depth) {
+	Ast *t = &c->ast;
+	Operand left, right;
+	if (N_VAR == astKind(t, astArg(t, n, 0)) && isLeaf(t, astArg(t, n, 1))) {
+		//cmp changes neither operand, so a variable in a register is compared where it is
+		left = leafOperand(c, astArg(t, n, 0));
+		right = leafOperand(c, astArg(t, n, 1));
+		if (O_REG == left.kind) {
+			gen(&c->code, OP_CMP, right, left);
+			return;
+		}
+	}
+	genOperands(c, n, k, depth, &left, &right);
+	gen(&c->code, OP_CMP, right, left);
+}
+
+//Generate code for an expression tree, leaving its value in regPool[k]
+//  regPool[0] to regPool[k - 1] hold values still to be used. Trees nested
+//  deeper than exprMaxDepth fall back to stack machine code, which saves the
+//  registers it would overwrite.
+void genValue(Compiler *c, int n, int k, int depth) {
+	Ast *t = &c->ast;
+	Code *code = &c->code;
+	Operand left, right;
+	int r = c->regPool[k];
+	int i, r8;
+
+	if (depth >= exprMaxDepth) {
+		for (i = 0; i < k; i++) {
+			if (R_AX == c->regPool[i] || R_BX == c->regPool[i])
+				gen(code, OP_PUSH, reg(c->regPool[i]), none);
+		}
+		genStackExpr(c, n);
+		if (R_AX != r)
+			gen(code, OP_MOV, reg(R_AX), reg(r));
+		for (i = k - 1; i >= 0; i--) {
+			if (R_AX == c->regPool[i] || R_BX == c->regPool[i])
+				gen(code, OP_POP, reg(c->regPool[i]), none);
+		}
+		return;
+	}
+	switch (astKind(t, n)) {
+		case N_NUM:
+		case N_VAR:
+			gen(code, OP_MOV, leafOperand(c, n), reg(r));
+			return;
+		case N_NEG:
+			genValue(c, astArg(t, n, 0), k, depth + 1);
+			gen(code, OP_NEG, reg(r), none);
+			return;
+		case N_NOT:
+			genValue(c, astArg(t, n, 0), k, depth + 1);
+			gen(code, OP_NOT, reg(r), none);
+			return;
+	}
+	genOperands(c, n, k, depth, &left, &right);
+	switch (astOp(t, n)) {
+		case '|':
+		case '~':
+		case '&':
+		case '+':
+		case '*':
+			//Commutative, so the result can go in whichever operand is regPool[k]
+			i = '|' == astOp(t, n) ? OP_OR : '~' == astOp(t, n) ? OP_XOR : '&' == astOp(t, n) ? OP_AND
+				: '+' == astOp(t, n) ? OP_ADD : OP_IMUL;
+			if (r == left.value)
+				gen(code, i, right, left);
+			else
+				gen(code, i, left, right);
+			return;
+		case '-':
+			if (r == left.value)
+				gen(code, OP_SUB, right, left);
+			else {
+				gen(code, OP_SUB, left, right);
+				gen(code, OP_NEG, right, none);
+			}
+			return;
+		case '/':
+			genDivide(c, left.value, right.value, k);
+			return;
+	}
+	//A relation: TRUE is -1
+	gen(code, OP_CMP, right, left);
+	//In 32-bit code %esi and %edi have no low byte register
+	r8 = TARGET_ELF64 == c->opt.target || R_AX == r || R_BX == r || R_CX == r ? r : R_DX;
+	genCond(code, OP_SET, astCond(t, n), reg8(r8));
+	gen(code, OP_NEG, reg8(r8), none);
+	gen(code, OP_MOVSX, reg8(r8), reg(r));
+}
+
+//Generate code for an expression tree, leaving its value in the primary register
+void genExpr(Compiler *c, int n) {
+	genValue(c, n, 0, 0);
+}
+
+//Generate code for an assignment
+//  A variable in a register is given a number or variable directly, and
+//  X = X op n, the usual loop counter step, is done in place.
+void genAssign(Compiler *c, int id, int n) {
+	Ast *t = &c->ast;
+	Operand dst = raOperand(&c->ra, id);
+	int op;
+	if (O_REG == dst.kind) {
+		if (isLeaf(t, n)) {
+			gen(&c->code, OP_MOV, leafOperand(c, n), dst);
+			return;
+		}
+		op = astOp(t, n);
+		if (N_BINARY == astKind(t, n) && NULL != strchr("|~&+-*", op)
+			&& N_VAR == astKind(t, astArg(t, n, 0)) && id == astArg(t, astArg(t, n, 0), 0) && isLeaf(t, astArg(t, n, 1))) {
+			op = '|' == op ? OP_OR : '~' == op ? OP_XOR : '&' == op ? OP_AND : '+' == op ? OP_ADD : '-' == op ? OP_SUB : OP_IMUL;
+			gen(&c->code, op, leafOperand(c, astArg(t, n, 1)), dst);
+			return;
+		}
+	}
+	genExpr(c, n);
+	store(c, id);
+}
+
+//Generate code that jumps to theLabel when a condition is TRUE (sense 1) or FALSE (sense 0)
+//  and falls through otherwise
+//  Conditions flagged AST_BOOL need no TRUE or FALSE value: a relation's compare
+//  sets the flags for a conditional jump, NOT swaps the sense, and & and |
+//  become chains of jumps that skip their right side once the result is known.
+//  Anything else, or nesting deeper than condMaxDepth, is evaluated and tested.
+void genJump(Compiler *c, int n, int theLabel, int sense, int depth) {
+	Ast *t = &c->ast;
+	int skip;
+	if (astBool(t, n) && depth < condMaxDepth) {
+		switch (astKind(t, n)) {
+			case N_NUM:
+				if ((0 != astArg(t, n, 0)) == sense)
+					branch(c, theLabel);
+				return;
+			case N_NOT:
+				genJump(c, astArg(t, n, 0), theLabel, !sense, depth + 1);
+				return;
+		}
+		switch (astOp(t, n)) {
+			case '&':
+			case '|':
+				//Jumping on FALSE through &, or on TRUE through |, each side can jump
+				//  straight there; otherwise the left side skips past the right
+				if (('|' == astOp(t, n)) == sense) {
+					genJump(c, astArg(t, n, 0), theLabel, sense, depth + 1);
+					genJump(c, astArg(t, n, 1), theLabel, sense, depth + 1);
+				}
+				else {
+					skip = newLabel(c);
+					genJump(c, astArg(t, n, 0), skip, !sense, depth + 1);
+					genJump(c, astArg(t, n, 1), theLabel, sense, depth + 1);
+					gen(&c->code, OP_LABEL, label(skip), none);
+				}
+				return;
+			case '~':
 				break;
+			default:
+				genCompare(c, n, 0, depth);
+				//Condition codes come in pairs, the opposite of each at the other end of bit 0
+				genCond(&c->code, OP_JCC, astCond(t, n) ^ !sense, label(theLabel));
+				return;
 		}
-		newLine();
 	}
+	genExpr(c, n);
+	gen(&c->code, OP_TEST, reg(R_AX), reg(R_AX));
+	genCond(&c->code, OP_JCC, sense ? CC_NE : CC_E, label(theLabel));
+}
+
+void genBlock(Compiler *c, int n);
+
+//Generate code for a statement
+void genStatement(Compiler *c, int n) {
+	Ast *t = &c->ast;
+	int label1, label2;
+	raStatement(&c->ra, &c->code);
+	setRegPool(c);
+	switch (astKind(t, n)) {
+		case N_ASSIGN:
+			genAssign(c, astArg(t, n, 1), astArg(t, n, 2));
+			break;
+		case N_READ:
+			readVar(c, astArg(t, n, 1));
+			break;
+		case N_WRITE:
+			genExpr(c, astArg(t, n, 1));
+			writeVar(c);
+			break;
+		case N_IF:
+			label1 = newLabel(c);
+			label2 = label1;
+			gen(&c->code, OP_COMMENT, note(NOTE_IF), none);
+			genJump(c, astArg(t, n, 1), label1, 0, 0);
+			genBlock(c, astArg(t, n, 2));
+			if (astOp(t, n)) {
+				label2 = newLabel(c);
+				branch(c, label2);
+				postLabel(c, label1, NOTE_ELSE);
+				genBlock(c, astArg(t, n, 3));
+			}
+			postLabel(c, label2, NOTE_ENDIF);
+			break;
+		case N_WHILE:
+			label1 = newLabel(c);
+			label2 = newLabel(c);
+			postLabel(c, label1, NOTE_WHILE);
+			genJump(c, astArg(t, n, 1), label2, 0, 0);
+			genBlock(c, astArg(t, n, 2));
+			raLoopEnd(&c->ra);
+			branch(c, label1);
+			postLabel(c, label2, NOTE_ENDWHILE);
+			break;
+	}
+	if (c->code.count >= codeFlushCount)
+		flushCode(c);
 }
 
-//Parse and translate an Assignment statement
-void assignment() {
-	char name[tokenbuflen];
-	strlcpy(name, value, tokenbuflen);
-	match('=');
-	boolExpression();
-	store(name);
+//Generate code for a list of statements
+void genBlock(Compiler *c, int n) {
+	for (; 0 != n; n = astNext(&c->ast, n))
+		genStatement(c, n);
 }
 
-void block();
+//Choose registers for the statements from body up to end, then generate their code
+//  part says they are not the whole program, so the variables are left in memory at the end
+void genOptimized(Compiler *c, int body, int end, int part) {
+	int i;
+	allocRegisters(&c->ra, &c->ast, body, end, c->syms.count, c->opt.target);
+	//Registers the program's caller expects back, like the frame pointer in %ebp
+	for (i = 0; i < c->ra.entrySavedCount; i++)
+		gen(&c->code, OP_PUSH, reg(c->ra.entrySaved[i]), none);
+	for (; end != body; body = astNext(&c->ast, body))
+		genStatement(c, body);
+	if (part)
+		raStoreAll(&c->ra, &c->code);
+	for (i = c->ra.entrySavedCount - 1; i >= 0; i--)
+		gen(&c->code, OP_POP, reg(c->ra.entrySaved[i]), none);
+}
 
-//Process a Read statement
-void doRead() {
-	match('(');
-	getName();
-	readVar();
-	while (',' == look) {
-		match(',');
-		getName();
-		readVar();
-	}
-	match(')');
+//Parse and translate a Main Program
+void doMain(Compiler *c) {
+	int body;
+	matchString(c, "BEGIN");
+	prolog(c);
+	body = block(c);
+	matchString(c, "END");
+	if (FORMAT_VM == c->opt.format)
+		vmCompile(&c->vm, &c->ast, body, c->syms.count);
+	else if (c->opt.optimize)
+		genOptimized(c, body, 0, 0);
+	epilog(c);
 }
 
-void doWrite() {
-	match('(');
-	expression();
-	writeVar();
-	while (',' == look) {
-		match(',');
-		expression();
-		writeVar();
-	}
-	match(')');
+//Parse and translate a Program
+void prog(Compiler *c) {
+	matchString(c, "PROGRAM");
+	header(c);
+	topDecls(c);
+	doMain(c);
+	match(c, '.');
 }
-	
 
-//Recognize and translate an IF construct
-void doIf() {
-	char label1[labelbufsize];
-	char label2[labelbufsize];
-	
-	newLabel(label1);
-	strlcpy(label2, label1, labelbufsize);
-	emitln("#IF");
-	boolExpression();
-	branchFalse(label1);
-	block();
-	if ('l' == token) {
-		newLabel(label2);
-		branch(label2);
-		postLabel(label1, "#ELSE");
-		block();
-	}
-	postLabel(label2, "#ENDIF");
-	matchString("ENDIF");
+//Initialize
+void init(Compiler *c) {
+	lex(&c->src, &c->syms, &c->toks, c->opt.lexThreads);
+	c->tokenPos = 0;
+	c->look = c->toks.t[0].kind;
+	scan(c);
+}
+
+//Compile a hot loop to machine code, for --tiered, and run it to its end
+//  The first time round, the WHILE statement is generated with -O as if it
+//  were the whole program, and loaded. Each time, the variables are copied
+//  into its data, and back out once it finishes.
+//  Returns 0, or -1 if the machine code can't be run here
+int tierLoop(void *ctx, int loop, int node, int *regs) {
+	Compiler *c = ctx;
+	TierLoop *l;
+	char symbol[32];
+	int id, failed;
+	if (NULL == c->tier) {
+		c->tier = calloc(c->vm.loopCount, sizeof(TierLoop));
+		if (NULL == c->tier)
+			abort();
+	}
+	l = &c->tier[loop];
+	if (NULL == l->code.entry) {
+		objStart(&c->obj, FORMAT_RUN);
+		objProlog(&c->obj, jitHelper);
+		for (id = 0; id < c->syms.count; id++)
+			objVar(&c->obj, id, 0);
+		c->labelCount = 0;
+		freeRegAlloc(&c->ra);
+		genOptimized(c, node, astNext(&c->ast, node), 1);
+		flushCode(c);
+		objEnd(&c->obj);
+		snprintf(symbol, sizeof symbol, "loop %d", loop);
+		failed = jitLoad(&l->code, &c->obj, symbol);
+		if (0 == failed)
+			l->vars = l->code.data + (c->syms.count ? c->obj.varAt[0] : 0);
+		freeObject(&c->obj);
+		if (0 != failed)
+			return -1;
+	}
+	memcpy(l->vars, regs, c->syms.count * sizeof(int));
+	l->code.entry();
+	memcpy(regs, l->vars, c->syms.count * sizeof(int));
+	return 0;
+}
+
+//Report what the optimizer did
+void report(Compiler *c) {
+	int i, n = 0;
+	if (!c->opt.optimize)
+		return;
+	if (FORMAT_VM == c->opt.format) {
+		fprintf(stderr, "%s%sbytecode: %d instructions, %d registers\n",
+				c->name ? c->name : "", c->name ? ": " : "", c->vm.count, c->vm.regCount);
+		if (c->opt.tiered) {
+			for (i = 0; NULL != c->tier && i < c->vm.loopCount; i++)
+				n += NULL != c->tier[i].code.entry;
+			fprintf(stderr, "%s%sloops compiled: %d of %d\n",
+					c->name ? c->name : "", c->name ? ": " : "", n, c->vm.loopCount);
+		}
+		return;
+	}
+	for (i = 0; i < peepRuleCount; i++) {
+		fprintf(stderr, "%s%speephole %s: applied %ld times\n",
+				c->name ? c->name : "", c->name ? ": " : "", peepRuleName[i], c->peepApplied[i]);
+	}
+	if (FORMAT_ASM != c->opt.format) {
+		fprintf(stderr, "%s%sshort jumps: %d of %d\n",
+				c->name ? c->name : "", c->name ? ": " : "", c->obj.shortJumps, c->obj.jumpCount);
+	}
 }
 
-//Recognize and translate a while statement
-void doWhile() {
-	char label1[labelbufsize];
-	char label2[labelbufsize];
+//Compile one source file
+//  srcPath and outPath may be NULL for stdin and stdout
+//  Returns 0 on success, nonzero if an error was reported
+int compile(Compiler *c, const char *srcPath, const char *outPath) {
+	int failed, i;
+	
+	memset(&c->src, 0, sizeof c->src);
+	memset(&c->syms, 0, sizeof c->syms);
+	memset(&c->toks, 0, sizeof c->toks);
+	memset(&c->code, 0, sizeof c->code);
+	c->code.target = c->opt.target;
+	memset(&c->out, 0, sizeof c->out);
+	memset(&c->ast, 0, sizeof c->ast);
+	memset(&c->ra, 0, sizeof c->ra);
+	memset(&c->obj, 0, sizeof c->obj);
+	memset(&c->vm, 0, sizeof c->vm);
+	if (c->opt.tiered) {
+		c->vm.hot = tierLoop;
+		c->vm.hotCtx = c;
+	}
+	c->tier = NULL;
+	c->look = TK_EOF;
+	c->tokenPos = -1;
+	c->token = 0;
+	c->value = "";
+	c->valueId = 0;
+	c->labelCount = 0;
+	c->opCount = 0;
+	c->valCount = 0;
+	memset(c->peepApplied, 0, sizeof c->peepApplied);
 	
-	newLabel(label1);
-	newLabel(label2);
-	postLabel(label1, "#WHILE");
-	boolExpression();
-	branchFalse(label2);
-	block();
-	matchString("ENDWHILE");
-	branch(label1);
-	postLabel(label2, "#ENDWHILE");
+	if (0 == setjmp(c->failed)) {
+		if (0 != openSource(&c->src, srcPath)) {
+			fail(c, "Can't read %s", srcPath ? srcPath : "stdin");
+		}
+		if (FORMAT_RUN != c->opt.format && FORMAT_VM != c->opt.format && 0 != openOutput(&c->out, outPath, FORMAT_EXE == c->opt.format ? 0777 : 0666)) {
+			fail(c, "Can't create %s", outPath);
+		}
+		init(c);
+		
+		prog(c);
+		if (TK_EOL != c->look) {
+			fail(c, "Unexpected data after '.'");
+		}
+		if (FORMAT_RUN == c->opt.format) {
+			c->tokenPos = -1; //Errors from here on are not in the source
+			if (0 != jitRun(&c->obj, srcPath, &c->status))
+				fail(c, "Can't run the program in memory");
+		}
+		else if (FORMAT_VM == c->opt.format) {
+			c->tokenPos = -1;
+			if (0 != vmRun(&c->vm, &c->status))
+				fail(c, "Division by zero");
+		}
+		else if (0 != closeOutput(&c->out)) {
+			fail(c, "Error writing %s", outPath ? outPath : "stdout");
+		}
+		failed = 0;
+		if (c->opt.verbose)
+			report(c);
+	}
+	else
+		failed = 1;
+	
+	free(c->ops);
+	c->ops = NULL;
+	c->opCapacity = 0;
+	free(c->vals);
+	c->vals = NULL;
+	c->valCapacity = 0;
+	freeAst(&c->ast);
+	freeRegAlloc(&c->ra);
+	freeObject(&c->obj);
+	for (i = 0; NULL != c->tier && i < c->vm.loopCount; i++)
+		jitFree(&c->tier[i].code);
+	free(c->tier);
+	c->tier = NULL;
+	freeVm(&c->vm);
+	freeCode(&c->code);
+	freeTokens(&c->toks);
+	freeSymbols(&c->syms);
+	closeSource(&c->src);
+	return failed;
+}
+
+//Report command line usage and halt
+void usage(const char *name) {
+	fprintf(stderr, "usage: %s [-Ov] [-j threads] [-t target] [-f format] [-o output] [source]\n", name);
+	fprintf(stderr, "       %s -b [-Ov] [-j threads] [-t target] [-f format] source...\n", name);
+	fprintf(stderr, "       %s --run [-Ov] [-j threads] [source]\n", name);
+	fprintf(stderr, "       %s --vm | --tiered [-v] [-j threads] [source]\n", name);
+	fprintf(stderr, "targets: macho32 (default), elf64\n");
+	fprintf(stderr, "formats: asm (default), obj, exe; obj and exe are elf64 only\n");
+	fprintf(stderr, "--vm and --tiered exit with status 0; --run and executables with main's last %%eax\n");
+	exit(2);
 }
 
-//Parse and translate a Block of statements
-void block() {
-	scan();
-	while ('e' != token && 'l' != token) {
-		switch (token) {
-			case 'i':
-				doIf();
+int main (int argc, const char * argv[]) {
+	Compiler c = {0};
+	const char *path = NULL;
+	const char *outPath = NULL;
+	int threads = 0; //-j, or 0 if not given
+	int batch = 0;
+	int targetSet = 0;
+	int opt;
+	static const struct option longOpts[] = {
+		{"run", no_argument, NULL, 'r'},
+		{"vm", no_argument, NULL, 'm'},
+		{"tiered", no_argument, NULL, 'T'},
+		{NULL, 0, NULL, 0}
+	};
+	
+	while (-1 != (opt = getopt_long(argc, (char * const *)argv, "bf:j:o:Ort:v", longOpts, NULL))) {
+		switch (opt) {
+			case 'O':
+				c.opt.optimize = 1;
 				break;
-			case 'w':
-				doWhile();
+			case 'v':
+				c.opt.verbose = 1;
 				break;
-			case 'R':
-				doRead();
+			case 'b':
+				batch = 1;
 				break;
-			case 'W':
-				doWrite();
+			case 'j':
+				threads = atoi(optarg);
+				if (threads < 1)
+					usage(argv[0]);
+				break;
+			case 'o':
+				outPath = optarg;
+				break;
+			case 't':
+				if (0 == strcmp(optarg, "elf64"))
+					c.opt.target = TARGET_ELF64;
+				else if (0 == strcmp(optarg, "macho32"))
+					c.opt.target = TARGET_MACHO32;
+				else
+					usage(argv[0]);
+				targetSet = 1;
+				break;
+			case 'r':
+				c.opt.format = FORMAT_RUN;
+				break;
+			case 'm':
+			case 'T':
+				//The bytecode is compiled from the syntax tree
+				c.opt.format = FORMAT_VM;
+				c.opt.optimize = 1;
+				c.opt.tiered = 'T' == opt;
+				break;
+			case 'f':
+				if (0 == strcmp(optarg, "asm"))
+					c.opt.format = FORMAT_ASM;
+				else if (0 == strcmp(optarg, "obj"))
+					c.opt.format = FORMAT_OBJ;
+				else if (0 == strcmp(optarg, "exe"))
+					c.opt.format = FORMAT_EXE;
+				else
+					usage(argv[0]);
 				break;
 			default:
-				assignment();
+				usage(argv[0]);
 				break;
 		}
-		scan();
 	}
-}
-
-//Parse and translate a Main Program
-void doMain() {
-	matchString("BEGIN");
-	prolog();
-	block();
-	matchString("END");
-	epilog();
-}
-
-//Parse and translate a Program
-void prog() {
-	matchString("PROGRAM");
-	header();
-	topDecls();
-	doMain();
-	match('.');
-}
-
-//Initialize
-void init() {
-	int i;
-	for (i=0; i<maxSymbols; i++) {
-		symbolTable[i] = NULL;
-		symbolType[i] = ' ';
+	//Bytecode has no target and no output file
+	if (FORMAT_VM == c.opt.format && (targetSet || batch || NULL != outPath))
+		usage(argv[0]);
+	if (c.opt.tiered)
+		c.opt.target = TARGET_ELF64; //For the hot loops
+	//The integrated assembler only knows x86-64
+	if (FORMAT_ASM != c.opt.format && FORMAT_VM != c.opt.format) {
+		if (targetSet && TARGET_ELF64 != c.opt.target)
+			usage(argv[0]);
+		c.opt.target = TARGET_ELF64;
 	}
-	getChar();
-	scan();
-}
-
-int main (int argc, const char * argv[]) {
-    init();
-	
-	prog();
-	if (!isEOL(look)) {
-		fail("Unexpected data after '.'");
+	if (FORMAT_RUN == c.opt.format && (batch || NULL != outPath))
+		usage(argv[0]);
+	if (batch) {
+		//Each file gets its own output, named after it
+		if (NULL != outPath || optind == argc)
+			usage(argv[0]);
+		if (0 == threads)
+			threads = sysconf(_SC_NPROCESSORS_ONLN);
+		return runBatch(argc - optind, argv + optind, threads, &c.opt) ? 1 : 0;
 	}
+	if (optind < argc - 1)
+		usage(argv[0]);
+	if (optind < argc)
+		path = argv[optind];
+	
+	//The chunked lexer has not been shown to pay off yet, so it is only used on request
+	c.opt.lexThreads = 0 == threads ? 1 : threads;
+	if (0 != compile(&c, path, outPath))
+		return 1;
 	
-    return 0;
+    return FORMAT_RUN == c.opt.format || FORMAT_VM == c.opt.format ? c.status : 0;
 }
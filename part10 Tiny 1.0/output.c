@@ -0,0 +1,137 @@
+/*
+ *  output.c
+ *  Lets's Build a Compiler
+ *  Assembly output sink. Generated text is appended to a large buffer that
+ *  is written out with a few big write() calls instead of going through
+ *  stdio for every instruction.
+ *
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include "output.h"
+
+//Write len bytes to the output file, retrying short writes
+static void writeAll(Output *out, const char *s, size_t len) {
+	while (len > 0 && !out->error) {
+		ssize_t n = write(out->fd, s, len);
+		if (n < 0) {
+			if (EINTR == errno)
+				continue;
+			out->error = 1;
+			break;
+		}
+		s += n;
+		len -= n;
+	}
+}
+
+//Direct output to a file
+//  path is the file to create, or NULL for stdout; mode is its permissions
+//  Returns 0 on success, -1 on failure
+int openOutput(Output *out, const char *path, int mode) {
+	memset(out, 0, sizeof *out);
+	out->buf = malloc(OUTPUT_BUFSIZE);
+	if (NULL == out->buf)
+		return -1;
+	out->ptr = out->buf;
+	out->end = out->buf + OUTPUT_BUFSIZE;
+	out->path = path;
+	out->fd = 1;
+	if (NULL != path) {
+		out->fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, mode);
+		if (out->fd < 0) {
+			free(out->buf);
+			out->buf = NULL;
+			return -1;
+		}
+	}
+	return 0;
+}
+
+//Flush the buffer and close the output file
+//  Returns 0 on success, -1 if any write failed
+int closeOutput(Output *out) {
+	int result;
+	outFlush(out);
+	if (NULL != out->path && 0 != close(out->fd))
+		out->error = 1;
+	result = out->error ? -1 : 0;
+	free(out->buf);
+	memset(out, 0, sizeof *out);
+	return result;
+}
+
+//Give up on the output after an error
+//Buffered text is discarded and a half-written output file is removed
+void abandonOutput(Output *out) {
+	if (NULL == out->buf)
+		return;
+	if (NULL != out->path) {
+		close(out->fd);
+		unlink(out->path);
+	}
+	free(out->buf);
+	memset(out, 0, sizeof *out);
+}
+
+//Write out everything in the buffer
+void outFlush(Output *out) {
+	writeAll(out, out->buf, out->ptr - out->buf);
+	out->ptr = out->buf;
+}
+
+//Append len bytes
+void outBytes(Output *out, const char *s, size_t len) {
+	if (len > (size_t)(out->end - out->ptr)) {
+		outFlush(out);
+		if (len >= OUTPUT_BUFSIZE) {
+			writeAll(out, s, len);
+			return;
+		}
+	}
+	memcpy(out->ptr, s, len);
+	out->ptr += len;
+}
+
+//Append a NUL-terminated string
+void outStr(Output *out, const char *s) {
+	outBytes(out, s, strlen(s));
+}
+
+//Append printf-style formatted text, formatting straight into the buffer
+void outvf(Output *out, const char *fmt, va_list args) {
+	va_list again;
+	int len;
+	va_copy(again, args);
+	len = vsnprintf(out->ptr, out->end - out->ptr, fmt, args);
+	if (len >= out->end - out->ptr) {
+		outFlush(out);
+		if (len < OUTPUT_BUFSIZE)
+			len = vsnprintf(out->ptr, out->end - out->ptr, fmt, again);
+		else {
+			char *s = malloc(len + 1);
+			if (NULL == s)
+				abort();
+			vsnprintf(s, len + 1, fmt, again);
+			writeAll(out, s, len);
+			free(s);
+			len = 0;
+		}
+	}
+	va_end(again);
+	if (len > 0)
+		out->ptr += len;
+}
+
+//Append printf-style formatted text
+void outf(Output *out, const char *fmt, ...) {
+	va_list args;
+	va_start(args, fmt);
+	outvf(out, fmt, args);
+	va_end(args);
+}
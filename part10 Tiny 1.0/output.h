@@ -0,0 +1,39 @@
+/*
+ *  output.h
+ *  Lets's Build a Compiler
+ *  Assembly output sink. Generated text is appended to a large buffer that
+ *  is written out with a few big write() calls instead of going through
+ *  stdio for every instruction.
+ *
+ */
+
+#include <stdarg.h>
+#include <stddef.h>
+
+#define OUTPUT_BUFSIZE (1024 * 1024)
+
+typedef struct Output {
+	char *buf;
+	char *ptr; //Next free byte in the output buffer
+	char *end; //End of the output buffer
+	int fd; //stdout unless -o was given
+	const char *path;
+	int error; //Set if a write has failed
+} Output;
+
+int openOutput(Output *out, const char *path, int mode);
+int closeOutput(Output *out);
+void abandonOutput(Output *out);
+
+void outFlush(Output *out);
+void outBytes(Output *out, const char *s, size_t len);
+void outStr(Output *out, const char *s);
+void outf(Output *out, const char *fmt, ...);
+void outvf(Output *out, const char *fmt, va_list args);
+
+//Append a single character
+static inline void outChar(Output *out, char c) {
+	if (out->ptr == out->end)
+		outFlush(out);
+	*out->ptr++ = c;
+}
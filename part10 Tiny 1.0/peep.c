@@ -0,0 +1,317 @@
+/*
+ *  peep.c
+ *  Lets's Build a Compiler
+ *  Peephole optimizer. Looks at the last few instructions of the stream
+ *  and replaces stack-machine sequences with direct register, immediate
+ *  and memory operand forms. A few rules also tidy the moves, exchanges
+ *  and divisions of the code for expressions given registers.
+ *
+ *  Instructions are copied down the array one at a time. After each one
+ *  the rules are tried on the instructions just copied, so a rewrite can
+ *  expose another match further back.
+ *
+ *  The stack machine rules rely on how that code uses registers: %ebx and
+ *  %edx are scratch, written before they are read within one operator's
+ *  code, and flags are only read by the instruction right after the one
+ *  that set them. Expressions given registers never push %eax to pop it
+ *  into %ebx, so their code does not match those rules.
+ *
+ *  For that code, a move straight back is dropped, an exchange after a
+ *  load becomes two moves, and a division by a power of two becomes a
+ *  shift. The shift relies on a register loaded with a number just before
+ *  a div being a temporary for it: the divisor is not read again, and
+ *  neither is the remainder in %edx.
+ *
+ */
+
+#include <string.h>
+#include "code.h"
+#include "peep.h"
+
+const char *const peepRuleName[peepRuleCount] = {
+	"store/load",
+	"load/xchg",
+	"div by power of two",
+	"push/load/pop/op",
+	"push/load/pop/sub/neg",
+	"push/load/pop/cmp",
+	"push/load/pop/mul",
+	"push/load/pop/div",
+	"load/push/.../pop/op"
+};
+
+//Recognize an instruction with the given operands
+static int is(const Instr *in, int op, int srcKind, int src, int dstKind, int dst) {
+	return in->op == op && in->srcKind == srcKind && in->src == src && in->dstKind == dstKind && in->dst == dst;
+}
+
+//Recognize a load of a number or variable into %eax
+static int isSimpleLoad(const Instr *in) {
+	return OP_MOV == in->op && (O_IMM == in->srcKind || O_VAR == in->srcKind)
+		&& O_REG == in->dstKind && R_AX == in->dst;
+}
+
+//Recognize push %eax / mov S,%eax / pop %ebx
+static int isPushLoadPop(const Instr *in) {
+	return is(&in[0], OP_PUSH, O_REG, R_AX, O_NONE, 0)
+		&& isSimpleLoad(&in[1])
+		&& is(&in[2], OP_POP, O_REG, R_BX, O_NONE, 0);
+}
+
+//Turn an instruction into op S,dst, taking S from a load
+static void setOperand(Instr *in, int op, const Instr *load, int dst) {
+	in->op = op;
+	in->cond = 0;
+	in->srcKind = load->srcKind;
+	in->src = load->src;
+	in->dstKind = O_REG;
+	in->dst = dst;
+}
+
+//Find the push that a pop at in[pop] matches
+//  Everything in between must be the code for one expression: balanced
+//  pushes and pops and no labels, jumps or calls
+//  Returns its index, or -1
+static int matchingPush(const Instr *in, int pop) {
+	int depth = 0;
+	int i;
+	for (i = pop - 1; i >= 0 && i >= pop - peepWindow; i--) {
+		switch (in[i].op) {
+			case OP_LABEL:
+			case OP_JMP:
+			case OP_JCC:
+			case OP_CALL:
+			case OP_COMMENT:
+				return -1;
+			case OP_POP:
+				depth++;
+				break;
+			case OP_PUSH:
+				if (0 == depth)
+					return is(&in[i], OP_PUSH, O_REG, R_AX, O_NONE, 0) ? i : -1;
+				depth--;
+				break;
+		}
+	}
+	return -1;
+}
+
+//mov S,%eax / push %eax / R / pop %ebx / op %ebx,%eax, where R is the code for the right operand
+//  The left operand is a number or variable, so it need not wait on the stack:
+//  R / op S,%eax for commutative ops, and the equivalents for the others
+static int applyLeftRule(Instr *end, int n, int *rule) {
+	Instr *in = end - n;
+	Instr *load;
+	int last = n - 1;
+	int pop, push, len;
+	//The operator's code is one instruction after the pop, or sub / neg
+	if (last >= 1 && is(&in[last], OP_NEG, O_REG, R_AX, O_NONE, 0) && is(&in[last - 1], OP_SUB, O_REG, R_BX, O_REG, R_AX))
+		pop = last - 2;
+	else if (last >= 1 && is(&in[last], OP_POP, O_REG, R_AX, O_NONE, 0) && is(&in[last - 1], OP_MOV, O_REG, R_AX, O_REG, R_BX))
+		pop = last; //Division: mov %eax,%ebx / pop %eax
+	else
+		pop = last - 1;
+	if (pop < 2 || (pop != last && !is(&in[pop], OP_POP, O_REG, R_BX, O_NONE, 0)))
+		return 0;
+	push = matchingPush(in, pop);
+	if (push < 1 || !isSimpleLoad(&in[push - 1]))
+		return 0;
+	//R must start by loading %eax, not by using the left operand in it
+	if (OP_MOV != in[push + 1].op || O_REG != in[push + 1].dstKind || R_AX != in[push + 1].dst
+		|| (O_REG == in[push + 1].srcKind && R_AX == in[push + 1].src))
+		return 0;
+	load = &in[push - 1];
+
+	if (pop == last) {
+		//Division: R / mov %eax,%ebx / mov S,%eax
+		Instr s = *load;
+		len = pop - push - 1; //R and the mov to %ebx
+		memmove(load, &in[push + 1], len * sizeof(Instr));
+		load[len] = s;
+		*rule = PEEP_LEFT;
+		return 2;
+	}
+	len = pop - push - 1; //R
+	switch (in[pop + 1].op) {
+		case OP_ADD:
+		case OP_AND:
+		case OP_OR:
+		case OP_XOR:
+			if (pop + 1 != last || !is(&in[pop + 1], in[pop + 1].op, O_REG, R_BX, O_REG, R_AX))
+				return 0;
+			//R / op S,%eax
+			setOperand(&in[pop + 1], in[pop + 1].op, load, R_AX);
+			in[pop] = in[pop + 1];
+			memmove(load, &in[push + 1], (len + 1) * sizeof(Instr));
+			*rule = PEEP_LEFT;
+			return 3;
+		case OP_SUB:
+			if (pop + 2 != last)
+				return 0;
+			//R / neg %eax / add S,%eax
+			setOperand(&in[pop + 1], OP_ADD, load, R_AX);
+			in[pop] = in[pop + 2]; //neg %eax
+			memmove(load, &in[push + 1], (len + 2) * sizeof(Instr));
+			*rule = PEEP_LEFT;
+			return 3;
+		case OP_MUL:
+			if (pop + 1 != last || !is(&in[pop + 1], OP_MUL, O_REG, R_BX, O_NONE, 0))
+				return 0;
+			//R / mov S,%ebx / mul %ebx
+			setOperand(&in[pop], OP_MOV, load, R_BX);
+			memmove(load, &in[push + 1], (len + 2) * sizeof(Instr));
+			*rule = PEEP_LEFT;
+			return 2;
+		case OP_CMP:
+			if (pop + 1 != last || !is(&in[pop + 1], OP_CMP, O_REG, R_AX, O_REG, R_BX))
+				return 0;
+			if (O_VAR == load->srcKind) {
+				//R / cmp %eax,X compares X with R the same way round
+				in[pop + 1].dstKind = O_VAR;
+				in[pop + 1].dst = load->src;
+				in[pop] = in[pop + 1];
+				memmove(load, &in[push + 1], (len + 1) * sizeof(Instr));
+				*rule = PEEP_LEFT;
+				return 3;
+			}
+			//R / mov $n,%ebx / cmp %eax,%ebx
+			setOperand(&in[pop], OP_MOV, load, R_BX);
+			memmove(load, &in[push + 1], (len + 2) * sizeof(Instr));
+			*rule = PEEP_LEFT;
+			return 2;
+	}
+	return 0;
+}
+
+//Recognize xor %edx,%edx / div R
+static int isDivide(const Instr *in, int r) {
+	return is(&in[0], OP_XOR, O_REG, R_DX, O_REG, R_DX) && is(&in[1], OP_DIV, O_REG, r, O_NONE, 0);
+}
+
+//Try the rules on the n instructions ending at end
+//  Returns the number of instructions removed, or -1 if no rule matched,
+//  with the rule that matched in *rule
+static int applyRules(Instr *end, int n, int *rule) {
+	Instr *in;
+	int k;
+	//mov X,Y / mov Y,X: X still holds the value, as in mov %eax,X / mov X,%eax
+	if (n >= 2) {
+		in = end - 2;
+		if (OP_MOV == in[0].op && (O_REG == in[0].srcKind || O_VAR == in[0].srcKind)
+			&& is(&in[1], OP_MOV, in[0].dstKind, in[0].dst, in[0].srcKind, in[0].src)) {
+			*rule = PEEP_STORE_LOAD;
+			return 1;
+		}
+	}
+	//mov S,R / xchg R,%eax: mov %eax,R / mov S,%eax, as the dividend is
+	//  swapped into %eax for div. Two moves are cheaper than an exchange.
+	if (n >= 2) {
+		in = end - 2;
+		if (OP_MOV == in[0].op && O_REG == in[0].dstKind && R_AX != in[0].dst
+			&& !(O_REG == in[0].srcKind && (R_AX == in[0].src || in[0].dst == in[0].src))
+			&& (is(&in[1], OP_XCHG, O_REG, in[0].dst, O_REG, R_AX) || is(&in[1], OP_XCHG, O_REG, R_AX, O_REG, in[0].dst))) {
+			in[1] = in[0];
+			in[0].srcKind = O_REG;
+			in[0].src = R_AX;
+			in[1].dst = R_AX;
+			*rule = PEEP_XCHG;
+			return 0;
+		}
+	}
+	//mov $n,R / xor %edx,%edx / div R: shr $k,%eax for n = 2^k, and nothing for n = 1
+	//  An xchg that swaps the dividend into %eax may come between the mov and the xor
+	if (n >= 3) {
+		in = end - 3;
+		if (n >= 4 && OP_XCHG == in[0].op && in[0].src != in[-1].dst && in[0].dst != in[-1].dst)
+			in--;
+		if (OP_MOV == in[0].op && O_IMM == in[0].srcKind && O_REG == in[0].dstKind && in[0].src > 0
+			&& 0 == (in[0].src & (in[0].src - 1)) && isDivide(end - 2, in[0].dst)) {
+			for (k = 0; 1 << k != in[0].src; k++)
+				;
+			*rule = PEEP_SHIFT;
+			if (in + 4 == end) {
+				in[0] = in[1]; //xchg
+				in++;
+			}
+			if (0 == k)
+				return 3;
+			in[0].op = OP_SHR;
+			in[0].srcKind = O_IMM;
+			in[0].src = k;
+			in[0].dstKind = O_REG;
+			in[0].dst = R_AX;
+			return 2;
+		}
+	}
+	//push %eax / mov S,%eax / pop %ebx / op %ebx,%eax: op S,%eax for commutative ops
+	if (n >= 4) {
+		in = end - 4;
+		if (isPushLoadPop(in) && O_REG == in[3].srcKind && R_BX == in[3].src && O_REG == in[3].dstKind && R_AX == in[3].dst
+			&& (OP_ADD == in[3].op || OP_AND == in[3].op || OP_OR == in[3].op || OP_XOR == in[3].op)) {
+			setOperand(&in[0], in[3].op, &in[1], R_AX);
+			*rule = PEEP_OPERAND;
+			return 3;
+		}
+	}
+	//push %eax / mov S,%eax / pop %ebx / sub %ebx,%eax / neg %eax: sub S,%eax
+	if (n >= 5) {
+		in = end - 5;
+		if (isPushLoadPop(in) && is(&in[3], OP_SUB, O_REG, R_BX, O_REG, R_AX) && is(&in[4], OP_NEG, O_REG, R_AX, O_NONE, 0)) {
+			setOperand(&in[0], OP_SUB, &in[1], R_AX);
+			*rule = PEEP_SUB;
+			return 4;
+		}
+	}
+	//push %eax / mov S,%eax / pop %ebx / cmp %eax,%ebx: cmp S,%eax compares the same way round
+	if (n >= 4) {
+		in = end - 4;
+		if (isPushLoadPop(in) && is(&in[3], OP_CMP, O_REG, R_AX, O_REG, R_BX)) {
+			setOperand(&in[0], OP_CMP, &in[1], R_AX);
+			*rule = PEEP_CMP;
+			return 3;
+		}
+	}
+	//push %eax / mov S,%eax / pop %ebx / mul %ebx: mov S,%ebx / mul %ebx
+	if (n >= 4) {
+		in = end - 4;
+		if (isPushLoadPop(in) && is(&in[3], OP_MUL, O_REG, R_BX, O_NONE, 0)) {
+			setOperand(&in[0], OP_MOV, &in[1], R_BX);
+			in[1] = in[3];
+			*rule = PEEP_MUL;
+			return 2;
+		}
+	}
+	//push %eax / mov S,%eax / mov %eax,%ebx / pop %eax: mov S,%ebx
+	if (n >= 4) {
+		in = end - 4;
+		if (is(&in[0], OP_PUSH, O_REG, R_AX, O_NONE, 0) && isSimpleLoad(&in[1])
+			&& is(&in[2], OP_MOV, O_REG, R_AX, O_REG, R_BX) && is(&in[3], OP_POP, O_REG, R_AX, O_NONE, 0)) {
+			setOperand(&in[0], OP_MOV, &in[1], R_BX);
+			*rule = PEEP_DIV;
+			return 3;
+		}
+	}
+	k = applyLeftRule(end, n, rule);
+	return k > 0 ? k : -1;
+}
+
+//Optimize the instruction stream from instruction start to the end
+//  applied[] counts the times each rule is applied
+void peephole(Code *code, int start, long applied[peepRuleCount]) {
+	Instr *instr = code->instr;
+	int out = start;
+	int i;
+	for (i = start; i < code->count; i++) {
+		int n, rule;
+		instr[out++] = instr[i];
+		//A label can be jumped to, so no rule looks back past one
+		if (OP_LABEL == instr[i].op)
+			start = out;
+		//load/xchg removes nothing, but it leaves a mov at the end, which it does not match
+		while ((n = applyRules(&instr[out], out - start, &rule)) >= 0) {
+			out -= n;
+			applied[rule]++;
+		}
+	}
+	code->count = out;
+}
@@ -0,0 +1,29 @@
+/*
+ *  peep.h
+ *  Lets's Build a Compiler
+ *  Peephole optimizer. Looks at the last few instructions of the stream
+ *  and replaces stack-machine sequences with direct register, immediate
+ *  and memory operand forms. A few rules also tidy the moves, exchanges
+ *  and divisions of the code for expressions given registers.
+ *
+ */
+
+#define peepWindow 64 //Furthest back a rule looks for a matching push
+
+//Rules, in the order they are tried
+enum {
+	PEEP_STORE_LOAD, //mov X,Y / mov Y,X
+	PEEP_XCHG, //mov S,R / xchg R,%eax
+	PEEP_SHIFT, //mov $n,R / xor %edx,%edx / div R, n a power of two
+	PEEP_OPERAND, //push %eax / mov S,%eax / pop %ebx / op %ebx,%eax
+	PEEP_SUB, //push %eax / mov S,%eax / pop %ebx / sub %ebx,%eax / neg %eax
+	PEEP_CMP, //push %eax / mov S,%eax / pop %ebx / cmp %eax,%ebx
+	PEEP_MUL, //push %eax / mov S,%eax / pop %ebx / mul %ebx
+	PEEP_DIV, //push %eax / mov S,%eax / mov %eax,%ebx / pop %eax
+	PEEP_LEFT, //mov S,%eax / push %eax / ... / pop %ebx / op %ebx,%eax
+	peepRuleCount
+};
+
+extern const char *const peepRuleName[peepRuleCount];
+
+void peephole(Code *code, int start, long applied[peepRuleCount]);
@@ -0,0 +1,362 @@
+/*
+ *  regalloc.c
+ *  Lets's Build a Compiler
+ *  Global register allocation. With -O, the variables used most, above
+ *  all inside loops, are kept in registers instead of memory.
+ *
+ *  This is not liveness analysis over a control flow graph, but a cheaper
+ *  approximation of it. Statements are numbered in the order their code is
+ *  generated, and a variable is taken to be live from the statement
+ *  holding its first use to its last use. To stay safe across loops, an
+ *  interval that touches a loop covers the whole of its outermost loop.
+ *  So a variable that is dead between two uses still holds its register,
+ *  and a variable assigned before each use in a loop is still loaded.
+ *  Intervals start at an outermost statement, never inside an IF or
+ *  WHILE, so the load that starts them runs on every path. Linear scan
+ *  then hands out the registers in order of interval start; when they run
+ *  out, the variable with the lightest loop-weighted use count stays in
+ *  memory.
+ *
+ *  A variable keeps one register for its whole interval and is loaded
+ *  from memory where the interval starts. The 32-bit runtime routines only
+ *  keep %ebp, so variables in %esi and %edi are pushed around READ and
+ *  WRITE calls when they are still needed afterwards. The x86-64 routines
+ *  leave eight registers alone, and none of them needs saving.
+ *
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include "code.h"
+#include "ast.h"
+#include "regalloc.h"
+
+#define raMaxWeight (1 << 30)
+
+#define bit(r) (1 << (r))
+
+//Registers for variables on each target, in order of preference
+//  entry: registers the program's caller expects back, saved around the program
+//  call: registers the runtime routines destroy, saved around READ and WRITE
+typedef struct {
+	int regs[raRegMax];
+	int count;
+	int entry;
+	int call;
+} RaTarget;
+
+static const RaTarget raTargets[] = {
+	[TARGET_MACHO32] = {{R_BP, R_SI, R_DI}, 3, bit(R_BP), bit(R_SI) | bit(R_DI)},
+	//%rbx is left out: the stack code for deep expressions pops into it
+	[TARGET_ELF64] = {{R_BP, R_R12, R_R13, R_R14, R_R15, R_R8, R_R9, R_R10}, 8,
+		bit(R_BP) | bit(R_R12) | bit(R_R13) | bit(R_R14) | bit(R_R15), 0},
+};
+
+//Analysis state
+typedef struct {
+	RegAlloc *ra;
+	const Ast *t;
+	int loopId; //Number of the current outermost loop
+	int outerStart; //Position of the current outermost statement
+	int end; //Statement the walk stops at, or 0
+} Walk;
+
+static void *raAlloc(size_t count, size_t size) {
+	void *p = calloc(count ? count : 1, size);
+	if (NULL == p)
+		abort();
+	return p;
+}
+
+//Record a use or assignment of a variable at position pos, depth loops deep
+static void noteVar(Walk *w, int id, int pos, int depth) {
+	RegAlloc *ra = w->ra;
+	int add = 1 << (depth < 10 ? 3 * depth : 27);
+	ra->weight[id] = ra->weight[id] < raMaxWeight - add ? ra->weight[id] + add : raMaxWeight;
+	if (ra->first[id] < 0)
+		ra->first[id] = w->outerStart;
+	if (ra->last[id] < pos)
+		ra->last[id] = pos;
+	if (depth > 0 && ra->loop[id] != w->loopId) {
+		ra->loop[id] = w->loopId;
+		ra->loopVars[ra->loopVarCount++] = id;
+	}
+}
+
+//Record an assignment of a variable, nest IFs and WHILEs deep
+static void noteDef(Walk *w, int id, int pos, int depth, int nest) {
+	RegAlloc *ra = w->ra;
+	if (ra->first[id] < 0 && 0 == nest)
+		ra->fresh[id] = 1;
+	noteVar(w, id, pos, depth);
+}
+
+//Record the variables in an expression
+//  The tree is walked with an explicit stack, so deep nesting is safe.
+static void noteExpr(Walk *w, int n, int pos, int depth) {
+	RegAlloc *ra = w->ra;
+	const Ast *t = w->t;
+	int sp = 0;
+	ra->stack[sp++] = n;
+	while (sp > 0) {
+		n = ra->stack[--sp];
+		if (sp + 2 > ra->stackCapacity) {
+			ra->stackCapacity *= 2;
+			ra->stack = realloc(ra->stack, ra->stackCapacity * sizeof(int));
+			if (NULL == ra->stack)
+				abort();
+		}
+		switch (astKind(t, n)) {
+			case N_VAR:
+				noteVar(w, astArg(t, n, 0), pos, depth);
+				break;
+			case N_NEG:
+			case N_NOT:
+				ra->stack[sp++] = astArg(t, n, 0);
+				break;
+			case N_BINARY:
+				ra->stack[sp++] = astArg(t, n, 0);
+				ra->stack[sp++] = astArg(t, n, 1);
+				break;
+		}
+	}
+}
+
+//Number a list of statements and record where each variable is used
+//  depth counts the loops around the statements, nest the IFs and WHILEs
+//  This must visit statements in the same order as genBlock
+static void walkBlock(Walk *w, int n, int depth, int nest) {
+	RegAlloc *ra = w->ra;
+	const Ast *t = w->t;
+	int pos, i;
+	for (; 0 != n && w->end != n; n = astNext(t, n)) {
+		pos = ++ra->pos;
+		if (0 == nest)
+			w->outerStart = pos;
+		switch (astKind(t, n)) {
+			case N_ASSIGN:
+				noteExpr(w, astArg(t, n, 2), pos, depth);
+				noteDef(w, astArg(t, n, 1), pos, depth, nest);
+				break;
+			case N_READ:
+				noteDef(w, astArg(t, n, 1), pos, depth, nest);
+				break;
+			case N_WRITE:
+				noteExpr(w, astArg(t, n, 1), pos, depth);
+				break;
+			case N_IF:
+				noteExpr(w, astArg(t, n, 1), pos, depth);
+				walkBlock(w, astArg(t, n, 2), depth, nest + 1);
+				walkBlock(w, astArg(t, n, 3), depth, nest + 1);
+				break;
+			case N_WHILE:
+				if (0 == depth) {
+					w->loopId++;
+					ra->loopVarCount = 0;
+				}
+				noteExpr(w, astArg(t, n, 1), pos, depth + 1);
+				walkBlock(w, astArg(t, n, 2), depth + 1, nest + 1);
+				pos = ++ra->pos;
+				if (0 == depth) {
+					//Everything used in the loop is live until its back edge
+					for (i = 0; i < ra->loopVarCount; i++)
+						ra->last[ra->loopVars[i]] = pos;
+				}
+				break;
+		}
+	}
+}
+
+//A variable and the start of its interval, for sorting
+//  The sort needs nothing else, so batch mode's threads can allocate at once.
+typedef struct {
+	int first;
+	int id;
+} RaStart;
+
+//Order variables by the start of their interval, then by ID
+static int byStart(const void *a, const void *b) {
+	const RaStart *x = a, *y = b;
+	if (x->first != y->first)
+		return x->first < y->first ? -1 : 1;
+	return x->id < y->id ? -1 : x->id > y->id;
+}
+
+//Choose registers for the variables used in the statements from body up to end
+//  end is 0 for the rest of the block, or a later statement in it
+void allocRegisters(RegAlloc *ra, const Ast *t, int body, int end, int symCount, int target) {
+	const RaTarget *rt = &raTargets[target];
+	Walk w;
+	int active[raRegMax]; //Variable holding each register during the scan, or -1
+	RaStart *sorted;
+	int used = 0;
+	int i, j, id, light;
+
+	memset(ra, 0, sizeof *ra);
+	ra->target = target;
+	ra->symCount = symCount;
+	ra->first = raAlloc(symCount, sizeof(int));
+	ra->last = raAlloc(symCount, sizeof(int));
+	ra->weight = raAlloc(symCount, sizeof(int));
+	ra->loop = raAlloc(symCount, sizeof(int));
+	ra->fresh = raAlloc(symCount, sizeof(char));
+	ra->reg = raAlloc(symCount, sizeof(int));
+	ra->loopVars = raAlloc(symCount, sizeof(int));
+	ra->stackCapacity = 1024;
+	ra->stack = raAlloc(ra->stackCapacity, sizeof(int));
+	for (i = 0; i < symCount; i++)
+		ra->first[i] = ra->last[i] = -1;
+
+	w.ra = ra;
+	w.t = t;
+	w.loopId = 0;
+	w.outerStart = 0;
+	w.end = end;
+	walkBlock(&w, body, 0, 0);
+
+	//Linear scan
+	sorted = raAlloc(symCount, sizeof(RaStart));
+	for (i = 0; i < symCount; i++) {
+		if (ra->first[i] >= 0 && ra->weight[i] >= raMinWeight) {
+			sorted[ra->startCount].first = ra->first[i];
+			sorted[ra->startCount++].id = i;
+		}
+	}
+	qsort(sorted, ra->startCount, sizeof(RaStart), byStart);
+	ra->starts = raAlloc(symCount, sizeof(int));
+	for (i = 0; i < ra->startCount; i++)
+		ra->starts[i] = sorted[i].id;
+	free(sorted);
+	for (j = 0; j < rt->count; j++)
+		active[j] = -1;
+	for (i = 0; i < ra->startCount; i++) {
+		id = ra->starts[i];
+		light = -1;
+		for (j = 0; j < rt->count; j++) {
+			if (active[j] >= 0 && ra->last[active[j]] < ra->first[id])
+				active[j] = -1; //Expired
+			if (active[j] < 0)
+				break;
+			if (light < 0 || ra->weight[active[j]] < ra->weight[active[light]])
+				light = j;
+		}
+		if (j == rt->count) {
+			//No register is free: the lightest of the live variables goes to memory
+			if (ra->weight[active[light]] >= ra->weight[id])
+				continue;
+			ra->reg[active[light]] = 0;
+			j = light;
+		}
+		active[j] = id;
+		ra->reg[id] = rt->regs[j];
+	}
+	for (i = 0; i < symCount; i++)
+		used |= 0 != ra->reg[i] ? bit(ra->reg[i]) : 0;
+	for (j = 0; j < rt->count; j++) {
+		if (used & rt->entry & bit(rt->regs[j]))
+			ra->entrySaved[ra->entrySavedCount++] = rt->regs[j];
+	}
+
+	//Keep only the variables that got a register, still in order of start
+	for (i = j = 0; i < ra->startCount; i++) {
+		if (0 != ra->reg[ra->starts[i]])
+			ra->starts[j++] = ra->starts[i];
+	}
+	ra->startCount = j;
+	ra->pos = 0;
+	ra->next = 0;
+	for (i = 0; i < 16; i++)
+		ra->occupant[i] = -1;
+}
+
+//Move on to the next statement, loading the variables whose intervals start there
+void raStatement(RegAlloc *ra, Code *code) {
+	int id;
+	ra->pos++;
+	while (ra->next < ra->startCount && ra->first[ra->starts[ra->next]] == ra->pos) {
+		id = ra->starts[ra->next++];
+		if (!ra->fresh[id])
+			gen(code, OP_MOV, var(id), reg(ra->reg[id]));
+		ra->occupant[ra->reg[id]] = id;
+	}
+}
+
+//Move past the end of a loop
+void raLoopEnd(RegAlloc *ra) {
+	ra->pos++;
+}
+
+//Store every variable in a register back to memory
+//  A whole program never needs this, but a loop compiled on its own does
+//  when it ends. Every variable in a loop lives until its end, so none of
+//  them share a register.
+void raStoreAll(RegAlloc *ra, Code *code) {
+	int i, id;
+	for (i = 0; i < ra->startCount; i++) {
+		id = ra->starts[i];
+		gen(code, OP_MOV, reg(ra->reg[id]), var(id));
+	}
+}
+
+//Is r saved around the program?
+static int entrySaved(const RegAlloc *ra, int r) {
+	int i;
+	for (i = 0; i < ra->entrySavedCount; i++) {
+		if (ra->entrySaved[i] == r)
+			return 1;
+	}
+	return 0;
+}
+
+//List the variable registers no variable is using in the current statement,
+//  except %ebp, which holds the program's frame pointer, and registers the
+//  program's caller expects back that are not saved
+//  Returns how many there are
+int raFreeRegs(const RegAlloc *ra, int *regs) {
+	const RaTarget *rt = &raTargets[ra->target];
+	int i, r, id, count = 0;
+	for (i = 0; i < rt->count; i++) {
+		r = rt->regs[i];
+		id = ra->occupant[r];
+		if (R_BP == r || ((rt->entry & bit(r)) && !entrySaved(ra, r)))
+			continue;
+		if (NULL == ra->reg || id < 0 || ra->last[id] < ra->pos)
+			regs[count++] = r;
+	}
+	return count;
+}
+
+//Save the variables a runtime call would destroy, if they are needed after it
+void raSave(RegAlloc *ra, Code *code) {
+	int i, r, id;
+	ra->savedCount = 0;
+	if (0 == ra->startCount)
+		return; //Nothing is in a register, or there is no allocation at all without -O
+	for (i = 0; i < raTargets[ra->target].count; i++) {
+		r = raTargets[ra->target].regs[i];
+		id = ra->occupant[r];
+		if ((raTargets[ra->target].call & bit(r)) && id >= 0 && ra->last[id] > ra->pos) {
+			gen(code, OP_PUSH, reg(r), none);
+			ra->saved[ra->savedCount++] = r;
+		}
+	}
+}
+
+//Restore what raSave saved
+void raRestore(RegAlloc *ra, Code *code) {
+	while (ra->savedCount > 0)
+		gen(code, OP_POP, reg(ra->saved[--ra->savedCount]), none);
+}
+
+void freeRegAlloc(RegAlloc *ra) {
+	free(ra->first);
+	free(ra->last);
+	free(ra->weight);
+	free(ra->loop);
+	free(ra->fresh);
+	free(ra->reg);
+	free(ra->starts);
+	free(ra->loopVars);
+	free(ra->stack);
+	memset(ra, 0, sizeof *ra);
+}
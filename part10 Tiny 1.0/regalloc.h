@@ -0,0 +1,48 @@
+/*
+ *  regalloc.h
+ *  Lets's Build a Compiler
+ *  Global register allocation. With -O, the variables used most, above
+ *  all inside loops, are kept in registers instead of memory.
+ *
+ */
+
+#define raRegMax 8 //Most registers handed out to variables, on any target
+#define raMinWeight 4 //Weight a variable needs to be worth its load: four uses, or one in a loop
+
+typedef struct {
+	int *first; //Position where each variable's live interval starts, or -1 if never used
+	int *last; //Position where it ends
+	int *weight; //Uses, weighted by loop depth
+	int *loop; //Outermost loop that last saw the variable
+	char *fresh; //First use is an assignment that always runs, so there is nothing to load
+	int *reg; //Register holding each variable, or 0 for memory
+	int *starts; //Variables given registers, by start of their interval
+	int startCount;
+	int *loopVars; //Variables referenced in the current outermost loop
+	int loopVarCount;
+	int *stack; //Expression walk stack
+	int stackCapacity;
+	int symCount;
+	int pos; //Position of the statement being generated
+	int next; //Next entry in starts to load
+	int target;
+	int occupant[16]; //Variable living in each register, or -1
+	int saved[raRegMax]; //Registers saved around a runtime call
+	int savedCount;
+	int entrySaved[raRegMax]; //Registers the program's caller expects back, saved around the program
+	int entrySavedCount;
+} RegAlloc;
+
+//Operand for a variable: its register, or its memory
+static inline Operand raOperand(const RegAlloc *ra, int id) {
+	return NULL != ra->reg && 0 != ra->reg[id] ? reg(ra->reg[id]) : var(id);
+}
+
+void allocRegisters(RegAlloc *ra, const Ast *t, int body, int end, int symCount, int target);
+void raStatement(RegAlloc *ra, Code *code);
+void raLoopEnd(RegAlloc *ra);
+void raStoreAll(RegAlloc *ra, Code *code);
+int raFreeRegs(const RegAlloc *ra, int *regs);
+void raSave(RegAlloc *ra, Code *code);
+void raRestore(RegAlloc *ra, Code *code);
+void freeRegAlloc(RegAlloc *ra);
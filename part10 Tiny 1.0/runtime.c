@@ -0,0 +1,107 @@
+/*
+ *  runtime.c
+ *  Lets's Build a Compiler
+ *  The runtime routines in C, for programs run inside the compiler. They
+ *  do what the assembly routines in asmheader.c do, on a buffer of their
+ *  own.
+ *
+ */
+
+#include <string.h>
+#include <unistd.h>
+#include "output.h"
+#include "asmheader.h"
+#include "runtime.h"
+
+static char rtIobuf[IOBUFSIZE];
+static char rtOutbuf[OUTBUFSIZE];
+static int rtOutlen;
+
+//Convert n to ASCII in the buffer and append a newline
+//  The same way as _convertToAscii: the digits are counted, then written
+//  from the right, two at a time
+//Returns the length of the string
+int rtConvertToAscii(int n) {
+	static const char digits[] = DIGIT_PAIRS;
+	static const unsigned powers[] = {1, 10, 100, 1000, 10000, 100000, 1000000, 10000000, 100000000, 1000000000};
+	char *p = rtIobuf;
+	unsigned u = n;
+	int count, len;
+	if (n < 0) {
+		*p++ = '-';
+		u = -u;
+	}
+	count = (32 - __builtin_clz(u | 1)) * 1233 >> 12;
+	p += count + ((u | 1) >= powers[count]);
+	*p = '\n';
+	len = p + 1 - rtIobuf;
+	for (; u >= 100; u /= 100) {
+		p -= 2;
+		memcpy(p, digits + u % 100 * 2, 2);
+	}
+	if (u >= 10)
+		memcpy(p - 2, digits + u * 2, 2);
+	else
+		p[-1] = '0' + u;
+	return len;
+}
+
+//Convert the len characters in the buffer to a number
+//  Commas are ignored, and anything else that is not a digit ends it
+int rtConvertFromAscii(int len) {
+	const char *p = rtIobuf;
+	unsigned n = 0;
+	int neg = 0, d;
+	if (len <= 0)
+		return 0;
+	if ('-' == *p) {
+		neg = 1;
+		p++;
+		len--;
+	}
+	for (; len > 0; len--) {
+		if (',' == *p) {
+			p++;
+			continue;
+		}
+		d = (unsigned char)*p++ - '0';
+		if (d < 0 || d > 9)
+			break;
+		n = n * 10 + d;
+	}
+	return neg ? -n : n;
+}
+
+//Write len characters from the buffer to stdout, by way of the output buffer
+int rtWriteIobuf(int len) {
+	if (rtOutlen + len > OUTBUFSIZE)
+		rtFlushOutput(0);
+	memcpy(rtOutbuf + rtOutlen, rtIobuf, len);
+	rtOutlen += len;
+	return len;
+}
+
+//Write out the output buffer and empty it
+//  unused is there because helper64Code passes %eax to every routine
+int rtFlushOutput(int unused) {
+	const char *p = rtOutbuf;
+	ssize_t n;
+	(void)unused;
+	while (rtOutlen > 0) {
+		n = write(stdout_num, p, rtOutlen);
+		if (n <= 0)
+			break;
+		p += n;
+		rtOutlen -= n;
+	}
+	rtOutlen = 0;
+	return 0;
+}
+
+//Read stdin into the buffer, after writing out what is waiting
+//  unused is there for helper64Code, as for rtFlushOutput
+int rtReadIobuf(int unused) {
+	(void)unused;
+	rtFlushOutput(0);
+	return read(stdin_num, rtIobuf, IOBUFSIZE);
+}
@@ -0,0 +1,14 @@
+/*
+ *  runtime.h
+ *  Lets's Build a Compiler
+ *  The runtime routines in C, for programs run inside the compiler. They
+ *  do what the assembly routines in asmheader.c do, on a buffer of their
+ *  own.
+ *
+ */
+
+int rtConvertToAscii(int n);
+int rtConvertFromAscii(int len);
+int rtWriteIobuf(int len);
+int rtReadIobuf(int unused);
+int rtFlushOutput(int unused);
@@ -0,0 +1,128 @@
+/*
+ *  symtab.c
+ *  Lets's Build a Compiler
+ *  Symbol table. Every identifier is interned once into a bump-allocated
+ *  arena and is known to the rest of the compiler by its 32-bit symbol ID.
+ *  An open-addressing hash table maps names to IDs in O(1).
+ *
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include "symtab.h"
+#include "input.h"
+
+#define initialSlots 256 //must be a power of two
+#define arenaChunkSize (64 * 1024)
+
+//Allocate memory or halt
+static void *xrealloc(void *p, size_t size) {
+	p = realloc(p, size);
+	if (NULL == p)
+		abort();
+	return p;
+}
+
+//Bump-allocate size bytes from the arena
+//Each chunk starts with a link to the previous one so freeSymbols can release them all
+static char *arenaAlloc(SymbolTable *syms, size_t size) {
+	char *p;
+	if (size > (size_t)(syms->arenaEnd - syms->arenaPtr)) {
+		size_t chunk = size > arenaChunkSize ? size : arenaChunkSize;
+		void **link = xrealloc(NULL, sizeof(void *) + chunk);
+		*link = syms->arenaChunks;
+		syms->arenaChunks = link;
+		syms->arenaPtr = (char *)(link + 1);
+		syms->arenaEnd = syms->arenaPtr + chunk;
+	}
+	p = syms->arenaPtr;
+	syms->arenaPtr += size;
+	return p;
+}
+
+//Compare a name from the source, in any case, with an interned name
+static int sameName(const Symbol *sym, const char *s, int len) {
+	int i;
+	if (sym->len != len)
+		return 0;
+	for (i = 0; i < len; i++) {
+		if (sym->name[i] != toUpper(s[i]))
+			return 0;
+	}
+	return 1;
+}
+
+//Find the slot for a name: either the one holding it or the empty one ending its probe sequence
+static unsigned findSlot(const SymbolTable *syms, const char *s, int len, unsigned hash) {
+	unsigned i = hash & syms->slotMask;
+	while (0 != syms->slots[i]) {
+		const Symbol *sym = &syms->table[syms->slots[i] - 1];
+		if (sym->hash == hash && sameName(sym, s, len))
+			break;
+		i = (i + 1) & syms->slotMask;
+	}
+	return i;
+}
+
+//Double the slot array and rehash every symbol into it
+static void growSlots(SymbolTable *syms) {
+	unsigned count = syms->slots ? 2 * (syms->slotMask + 1) : initialSlots;
+	int i;
+	free(syms->slots);
+	syms->slots = calloc(count, sizeof(int));
+	if (NULL == syms->slots)
+		abort();
+	syms->slotMask = count - 1;
+	for (i = 0; i < syms->count; i++) {
+		unsigned j = syms->table[i].hash & syms->slotMask;
+		while (0 != syms->slots[j])
+			j = (j + 1) & syms->slotMask;
+		syms->slots[j] = i + 1;
+	}
+}
+
+//Intern a name
+//  s need not be terminated or upper case; hash is of the upper-cased name
+//  Returns the symbol ID, adding a new undeclared symbol the first time a name is seen
+int symIntern(SymbolTable *syms, const char *s, int len, unsigned hash) {
+	Symbol *sym;
+	char *name;
+	unsigned slot;
+	int i;
+	//Keep the load factor at or below 1/2
+	if (NULL == syms->slots || 2 * (unsigned)(syms->count + 1) > syms->slotMask + 1)
+		growSlots(syms);
+	slot = findSlot(syms, s, len, hash);
+	if (0 != syms->slots[slot])
+		return syms->slots[slot] - 1;
+	
+	if (syms->count == syms->capacity) {
+		syms->capacity = syms->capacity ? 2 * syms->capacity : initialSlots;
+		syms->table = xrealloc(syms->table, syms->capacity * sizeof(Symbol));
+	}
+	name = arenaAlloc(syms, len + 1);
+	for (i = 0; i < len; i++)
+		name[i] = toUpper(s[i]);
+	name[len] = 0x00;
+	sym = &syms->table[syms->count];
+	sym->name = name;
+	sym->len = len;
+	sym->hash = hash;
+	sym->type = ' ';
+	sym->token = 0;
+	syms->slots[slot] = ++syms->count;
+	return syms->count - 1;
+}
+
+//Release the table, the slots and every arena chunk
+void freeSymbols(SymbolTable *syms) {
+	void *chunk = syms->arenaChunks;
+	while (NULL != chunk) {
+		void *prev = *(void **)chunk;
+		free(chunk);
+		chunk = prev;
+	}
+	free(syms->table);
+	free(syms->slots);
+	memset(syms, 0, sizeof *syms);
+}
@@ -0,0 +1,34 @@
+/*
+ *  symtab.h
+ *  Lets's Build a Compiler
+ *  Symbol table. Every identifier is interned once into a bump-allocated
+ *  arena and is known to the rest of the compiler by its 32-bit symbol ID.
+ *  An open-addressing hash table maps names to IDs in O(1).
+ *
+ */
+
+//FNV-1a hash, computed a character at a time while the scanner reads a name
+#define hashInit 2166136261u
+#define hashStep(h, c) (((h) ^ (unsigned char)(c)) * 16777619u)
+
+typedef struct {
+	const char *name; //Upper-cased, NUL-terminated name in the arena
+	int len;
+	unsigned hash;
+	char type; //' ' until the identifier is declared
+	char token; //Keyword code, 0 until the scanner first classifies the name
+} Symbol;
+
+typedef struct SymbolTable {
+	Symbol *table; //Indexed by symbol ID
+	int count;
+	int capacity;
+	int *slots; //symbol ID + 1 for each slot, 0 if the slot is empty
+	unsigned slotMask; //slot count - 1
+	char *arenaPtr; //Next free byte in the current arena chunk
+	char *arenaEnd; //End of the current arena chunk
+	void *arenaChunks; //Chain of every chunk allocated, for freeSymbols
+} SymbolTable;
+
+int symIntern(SymbolTable *syms, const char *s, int len, unsigned hash);
+void freeSymbols(SymbolTable *syms);
@@ -0,0 +1,453 @@
+/*
+ *  vm.c
+ *  Lets's Build a Compiler
+ *  Bytecode interpreter. With --vm, the syntax tree is compiled to a
+ *  register-based bytecode and run inside the compiler, wherever native
+ *  code can't be generated or run.
+ *
+ *  Every variable has a register of its own, so an instruction names its
+ *  operands and its result directly: X = X + 1 is one ADDK, where a stack
+ *  machine would load, push, add and store. Conditions compile like
+ *  genJump's, to compare-and-branch instructions, and a loop tests at its
+ *  bottom, so each trip runs one branch.
+ *
+ *  The interpreter is threaded: every instruction ends with its own
+ *  indirect jump to the next one's handler, through GCC's computed goto,
+ *  instead of going back round a switch.
+ *
+ *  With --tiered, the interpreter is the first tier. Every WHILE counts
+ *  its trips at its test, and once a loop has gone round vmHotLoop times
+ *  it is handed to the hot loop routine, which compiles it to machine
+ *  code and runs it from there to its end: the loop is replaced on the
+ *  stack, mid-run, with the variables carried across in the registers.
+ *
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+#include "ast.h"
+#include "code.h"
+#include "runtime.h"
+#include "vm.h"
+
+#define vmCondMaxDepth 1000 //Deepest & and | nesting compiled to branches, as in genJump
+
+//Register for the temporary at position i of an expression's operand stack
+#define vmTemp(vm, i) ((vm)->varCount + (i))
+
+//Relation instructions, by condition code, counted from VM_EQ
+//  They come in pairs, the opposite of each at the other end of bit 0.
+static const char vmRel[16] = {
+	[CC_E] = 0, [CC_NE] = 1, [CC_L] = 2, [CC_GE] = 3, [CC_LE] = 4, [CC_G] = 5
+};
+
+//The same relation with its operands swapped
+static const char vmMirror[6] = {0, 1, 5, 4, 3, 2};
+
+//Make room for count more elements in an array
+static void *grow(void *p, int *capacity, int count, size_t size) {
+	if (count <= *capacity)
+		return p;
+	while (*capacity < count)
+		*capacity = *capacity ? 2 * *capacity : 1024;
+	p = realloc(p, *capacity * size);
+	if (NULL == p)
+		abort();
+	return p;
+}
+
+//Make sure register r exists; new registers start at 0
+static void vmUseReg(Vm *vm, int r) {
+	int old = vm->regCapacity;
+	if (r < vm->regCount)
+		return;
+	vm->init = grow(vm->init, &vm->regCapacity, r + 1, sizeof(int));
+	memset(vm->init + old, 0, (vm->regCapacity - old) * sizeof(int));
+	vm->regCount = r + 1;
+}
+
+//Give variable id its starting value
+void vmVar(Vm *vm, int id, int value) {
+	vmUseReg(vm, id);
+	vm->init[id] = value;
+}
+
+static void vmEmit(Vm *vm, int op, int a, int b, int c) {
+	VmInstr *in;
+	vm->code = grow(vm->code, &vm->capacity, vm->count + 1, sizeof(VmInstr));
+	in = &vm->code[vm->count++];
+	in->op = op;
+	in->a = a;
+	in->b = b;
+	in->c = c;
+}
+
+static int vmNewLabel(Vm *vm) {
+	vm->labelAt = grow(vm->labelAt, &vm->labelCapacity, vm->labelCount + 1, sizeof(int));
+	return vm->labelCount++;
+}
+
+static void vmPostLabel(Vm *vm, int label) {
+	vm->labelAt[label] = vm->count;
+}
+
+//Make room for count entries on the expression stacks
+static void vmReserve(Vm *vm, int count) {
+	int capacity = vm->stackCapacity;
+	vm->work = grow(vm->work, &capacity, count, sizeof(int));
+	vm->vals = grow(vm->vals, &vm->stackCapacity, count, sizeof(VmValue));
+}
+
+//Put a constant operand in register r
+static VmValue vmLoad(Vm *vm, VmValue x, int r) {
+	if (x.isConst) {
+		vmEmit(vm, VM_LOADK, r, 0, x.v);
+		vmUseReg(vm, r);
+		x.isConst = 0;
+		x.v = r;
+	}
+	return x;
+}
+
+//Compile r = x op y
+static void vmBinary(Vm *vm, int op, int cond, int r, VmValue x, VmValue y) {
+	VmValue swap;
+	int i, rel;
+	switch (op) {
+		case '+': i = 0; break;
+		case '-': i = 1; break;
+		case '*': i = 2; break;
+		case '/': i = 3; break;
+		case '&': i = 4; break;
+		case '|': i = 5; break;
+		case '~': i = 6; break;
+		default:
+			//A relation
+			rel = vmRel[cond];
+			if (x.isConst && y.isConst)
+				x = vmLoad(vm, x, r);
+			if (x.isConst) {
+				swap = x;
+				x = y;
+				y = swap;
+				rel = vmMirror[rel];
+			}
+			vmEmit(vm, (y.isConst ? VM_EQK : VM_EQ) + rel, r, x.v, y.v);
+			return;
+	}
+	if (x.isConst && y.isConst)
+		x = vmLoad(vm, x, r);
+	if (!x.isConst)
+		vmEmit(vm, (y.isConst ? VM_ADDK : VM_ADD) + i, r, x.v, y.v);
+	else if ('-' == op)
+		vmEmit(vm, VM_KSUB, r, y.v, x.v);
+	else if ('/' == op)
+		vmEmit(vm, VM_KDIV, r, y.v, x.v);
+	else
+		vmEmit(vm, VM_ADDK + i, r, y.v, x.v); //The rest commute
+}
+
+//Compile an expression, its temporaries from position base of the operand stack
+//  The value of the whole expression goes in register dst if it is computed,
+//  or dst is -1 for a temporary; numbers and variables are left where they are.
+//  The tree is walked with an explicit stack, so deep nesting is safe.
+//  Returns the register or constant holding the value
+static VmValue vmExpr(Vm *vm, const Ast *t, int root, int dst, int base) {
+	int sp = 0, vp = 0;
+	int e, n, r;
+	VmValue x, y;
+	vmReserve(vm, 1);
+	vm->work[sp++] = root << 1; //Bit 0 is set once the operands are done
+	while (sp > 0) {
+		vmReserve(vm, sp + vp + 3);
+		e = vm->work[--sp];
+		n = e >> 1;
+		switch (astKind(t, n)) {
+			case N_NUM:
+			case N_VAR:
+				vm->vals[vp].isConst = N_NUM == astKind(t, n);
+				vm->vals[vp++].v = astArg(t, n, 0);
+				continue;
+		}
+		if (0 == (e & 1)) {
+			vm->work[sp++] = e | 1;
+			if (N_BINARY == astKind(t, n))
+				vm->work[sp++] = astArg(t, n, 1) << 1;
+			vm->work[sp++] = astArg(t, n, 0) << 1;
+			continue;
+		}
+		if (N_BINARY == astKind(t, n)) {
+			y = vm->vals[--vp];
+			x = vm->vals[--vp];
+			r = n == root && dst >= 0 ? dst : vmTemp(vm, base + vp);
+			vmBinary(vm, astOp(t, n), astCond(t, n), r, x, y);
+		}
+		else {
+			x = vm->vals[--vp];
+			r = n == root && dst >= 0 ? dst : vmTemp(vm, base + vp);
+			x = vmLoad(vm, x, r);
+			vmEmit(vm, N_NEG == astKind(t, n) ? VM_NEG : VM_NOT, r, x.v, 0);
+		}
+		vmUseReg(vm, r);
+		vm->vals[vp].isConst = 0;
+		vm->vals[vp++].v = r;
+	}
+	return vm->vals[0];
+}
+
+//Compile a branch to label when a condition is TRUE (sense 1) or FALSE (sense 0)
+//  This follows genJump: relations branch on their own, NOT swaps the sense,
+//  and & and | become chains of branches.
+static void vmJump(Vm *vm, const Ast *t, int n, int label, int sense, int depth) {
+	VmValue x, y, swap;
+	int skip, rel;
+	if (astBool(t, n) && depth < vmCondMaxDepth) {
+		switch (astKind(t, n)) {
+			case N_NUM:
+				if ((0 != astArg(t, n, 0)) == sense)
+					vmEmit(vm, VM_JMP, 0, 0, label);
+				return;
+			case N_NOT:
+				vmJump(vm, t, astArg(t, n, 0), label, !sense, depth + 1);
+				return;
+		}
+		switch (astOp(t, n)) {
+			case '&':
+			case '|':
+				if (('|' == astOp(t, n)) == sense) {
+					vmJump(vm, t, astArg(t, n, 0), label, sense, depth + 1);
+					vmJump(vm, t, astArg(t, n, 1), label, sense, depth + 1);
+				}
+				else {
+					skip = vmNewLabel(vm);
+					vmJump(vm, t, astArg(t, n, 0), skip, !sense, depth + 1);
+					vmJump(vm, t, astArg(t, n, 1), label, sense, depth + 1);
+					vmPostLabel(vm, skip);
+				}
+				return;
+			case '~':
+				break;
+			default:
+				x = vmExpr(vm, t, astArg(t, n, 0), -1, 0);
+				y = vmExpr(vm, t, astArg(t, n, 1), -1, 1);
+				rel = vmRel[astCond(t, n)] ^ !sense;
+				if (x.isConst && y.isConst)
+					x = vmLoad(vm, x, vmTemp(vm, 0));
+				if (x.isConst) {
+					swap = x;
+					x = y;
+					y = swap;
+					rel = vmMirror[rel];
+				}
+				vmEmit(vm, (y.isConst ? VM_BEQK : VM_BEQ) + rel, x.v, y.v, label);
+				return;
+		}
+	}
+	x = vmExpr(vm, t, n, -1, 0);
+	if (x.isConst) {
+		if ((0 != x.v) == sense)
+			vmEmit(vm, VM_JMP, 0, 0, label);
+		return;
+	}
+	vmEmit(vm, sense ? VM_JNZ : VM_JZ, x.v, 0, label);
+}
+
+//Compile a list of statements
+static void vmBlock(Vm *vm, const Ast *t, int n) {
+	VmValue x;
+	int id, label1, label2, label3;
+	for (; 0 != n; n = astNext(t, n)) {
+		switch (astKind(t, n)) {
+			case N_ASSIGN:
+				//The expression's last instruction stores straight into the variable
+				id = astArg(t, n, 1);
+				x = vmExpr(vm, t, astArg(t, n, 2), id, 0);
+				if (x.isConst)
+					vmEmit(vm, VM_LOADK, id, 0, x.v);
+				else if (x.v != id)
+					vmEmit(vm, VM_MOV, id, x.v, 0);
+				break;
+			case N_READ:
+				vmEmit(vm, VM_READ, astArg(t, n, 1), 0, 0);
+				break;
+			case N_WRITE:
+				x = vmLoad(vm, vmExpr(vm, t, astArg(t, n, 1), -1, 0), vmTemp(vm, 0));
+				vmEmit(vm, VM_WRITE, x.v, 0, 0);
+				break;
+			case N_IF:
+				label1 = vmNewLabel(vm);
+				label2 = label1;
+				vmJump(vm, t, astArg(t, n, 1), label1, 0, 0);
+				vmBlock(vm, t, astArg(t, n, 2));
+				if (astOp(t, n)) {
+					label2 = vmNewLabel(vm);
+					vmEmit(vm, VM_JMP, 0, 0, label2);
+					vmPostLabel(vm, label1);
+					vmBlock(vm, t, astArg(t, n, 3));
+				}
+				vmPostLabel(vm, label2);
+				break;
+			case N_WHILE:
+				//Jump to the test at the bottom
+				label1 = vmNewLabel(vm);
+				label2 = vmNewLabel(vm);
+				vmEmit(vm, VM_JMP, 0, 0, label2);
+				vmPostLabel(vm, label1);
+				vmBlock(vm, t, astArg(t, n, 2));
+				vmPostLabel(vm, label2);
+				if (NULL != vm->hot) {
+					label3 = vmNewLabel(vm);
+					vm->loopNode = grow(vm->loopNode, &vm->loopCapacity, vm->loopCount + 1, sizeof(int));
+					vm->loopNode[vm->loopCount] = n;
+					vmEmit(vm, VM_LOOP, vm->loopCount++, 0, label3);
+					vmJump(vm, t, astArg(t, n, 1), label1, 1, 0);
+					vmPostLabel(vm, label3);
+				}
+				else
+					vmJump(vm, t, astArg(t, n, 1), label1, 1, 0);
+				break;
+		}
+	}
+}
+
+//Compile the statements from body on
+void vmCompile(Vm *vm, const Ast *t, int body, int symCount) {
+	int i;
+	vm->varCount = symCount;
+	vmUseReg(vm, symCount - 1);
+	vmBlock(vm, t, body);
+	vmEmit(vm, VM_HALT, 0, 0, 0);
+	//Labels become instruction numbers
+	for (i = 0; i < vm->count; i++) {
+		if (vm->code[i].op >= VM_JMP && vm->code[i].op <= VM_LOOP)
+			vm->code[i].c = vm->labelAt[vm->code[i].c];
+	}
+}
+
+//Run the program
+//  Returns 0 with 0 in *status, or -1 if it divided by zero
+int vmRun(const Vm *vm, int *status) {
+	static void *const go[vmOpCount] = {
+		[VM_HALT] = &&halt, [VM_MOV] = &&mov, [VM_LOADK] = &&loadk,
+		[VM_ADD] = &&add, [VM_SUB] = &&sub, [VM_MUL] = &&mul, [VM_DIV] = &&div,
+		[VM_AND] = &&and, [VM_OR] = &&or, [VM_XOR] = &&xor,
+		[VM_ADDK] = &&addk, [VM_SUBK] = &&subk, [VM_MULK] = &&mulk, [VM_DIVK] = &&divk,
+		[VM_ANDK] = &&andk, [VM_ORK] = &&ork, [VM_XORK] = &&xork,
+		[VM_KSUB] = &&ksub, [VM_KDIV] = &&kdiv, [VM_NEG] = &&neg, [VM_NOT] = &&not,
+		[VM_EQ] = &&eq, [VM_NE] = &&ne, [VM_LT] = &&lt, [VM_GE] = &&ge, [VM_LE] = &&le, [VM_GT] = &&gt,
+		[VM_EQK] = &&eqk, [VM_NEK] = &&nek, [VM_LTK] = &&ltk, [VM_GEK] = &&gek, [VM_LEK] = &&lek, [VM_GTK] = &&gtk,
+		[VM_JMP] = &&jmp, [VM_JZ] = &&jz, [VM_JNZ] = &&jnz,
+		[VM_BEQ] = &&beq, [VM_BNE] = &&bne, [VM_BLT] = &&blt, [VM_BGE] = &&bge, [VM_BLE] = &&ble, [VM_BGT] = &&bgt,
+		[VM_BEQK] = &&beqk, [VM_BNEK] = &&bnek, [VM_BLTK] = &&bltk, [VM_BGEK] = &&bgek, [VM_BLEK] = &&blek, [VM_BGTK] = &&bgtk,
+		[VM_LOOP] = &&loop, [VM_READ] = &&read, [VM_WRITE] = &&write,
+	};
+	const VmInstr *code = vm->code;
+	const VmInstr *pc = code;
+	int *r = malloc(vm->regCount * sizeof(int));
+	int *trips = calloc(vm->loopCount ? vm->loopCount : 1, sizeof(int)); //Trips round each loop
+	if (NULL == r || NULL == trips)
+		abort();
+	memcpy(r, vm->init, vm->regCount * sizeof(int));
+
+//Operands of the current instruction; arithmetic is unsigned, so it wraps
+#define A r[pc->a]
+#define B r[pc->b]
+#define C r[pc->c]
+#define UB ((unsigned)B)
+#define UC ((unsigned)C)
+#define K ((unsigned)pc->c)
+#define next() goto *go[(++pc)->op]
+#define branch(cond) pc = (cond) ? code + pc->c : pc + 1; goto *go[pc->op]
+
+	goto *go[pc->op];
+mov:	A = B; next();
+loadk:	A = pc->c; next();
+add:	A = UB + UC; next();
+sub:	A = UB - UC; next();
+mul:	A = UB * UC; next();
+div:	if (0 == C) goto fault; A = UB / UC; next();
+and:	A = UB & UC; next();
+or:		A = UB | UC; next();
+xor:	A = UB ^ UC; next();
+addk:	A = UB + K; next();
+subk:	A = UB - K; next();
+mulk:	A = UB * K; next();
+divk:	if (0 == K) goto fault; A = UB / K; next();
+andk:	A = UB & K; next();
+ork:	A = UB | K; next();
+xork:	A = UB ^ K; next();
+ksub:	A = K - UB; next();
+kdiv:	if (0 == B) goto fault; A = K / UB; next();
+neg:	A = -UB; next();
+not:	A = ~UB; next();
+eq:		A = -(B == C); next();
+ne:		A = -(B != C); next();
+lt:		A = -(B < C); next();
+ge:		A = -(B >= C); next();
+le:		A = -(B <= C); next();
+gt:		A = -(B > C); next();
+eqk:	A = -(B == pc->c); next();
+nek:	A = -(B != pc->c); next();
+ltk:	A = -(B < pc->c); next();
+gek:	A = -(B >= pc->c); next();
+lek:	A = -(B <= pc->c); next();
+gtk:	A = -(B > pc->c); next();
+jmp:	branch(1);
+jz:		branch(0 == A);
+jnz:	branch(0 != A);
+beq:	branch(A == B);
+bne:	branch(A != B);
+blt:	branch(A < B);
+bge:	branch(A >= B);
+ble:	branch(A <= B);
+bgt:	branch(A > B);
+beqk:	branch(A == pc->b);
+bnek:	branch(A != pc->b);
+bltk:	branch(A < pc->b);
+bgek:	branch(A >= pc->b);
+blek:	branch(A <= pc->b);
+bgtk:	branch(A > pc->b);
+loop:
+	if (++trips[pc->a] >= vmHotLoop) {
+		if (0 == vm->hot(vm->hotCtx, pc->a, vm->loopNode[pc->a], r)) {
+			pc = code + pc->c;
+			goto *go[pc->op];
+		}
+		trips[pc->a] = INT_MIN; //It can't be compiled: stop asking
+	}
+	next();
+read:	A = rtConvertFromAscii(rtReadIobuf(0)); next();
+write:	rtWriteIobuf(rtConvertToAscii(A)); next();
+
+#undef A
+#undef B
+#undef C
+#undef UB
+#undef UC
+#undef K
+#undef next
+#undef branch
+
+halt:
+	rtFlushOutput(0);
+	free(r);
+	free(trips);
+	*status = 0;
+	return 0;
+fault:
+	rtFlushOutput(0);
+	free(r);
+	free(trips);
+	return -1;
+}
+
+void freeVm(Vm *vm) {
+	free(vm->code);
+	free(vm->init);
+	free(vm->labelAt);
+	free(vm->work);
+	free(vm->vals);
+	free(vm->loopNode);
+	memset(vm, 0, sizeof *vm);
+}
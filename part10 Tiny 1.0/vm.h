@@ -0,0 +1,81 @@
+/*
+ *  vm.h
+ *  Lets's Build a Compiler
+ *  Bytecode interpreter. With --vm, the syntax tree is compiled to a
+ *  register-based bytecode and run inside the compiler, wherever native
+ *  code can't be generated or run.
+ *
+ *  A program run here always exits with status 0. Native code exits with
+ *  whatever main leaves in %eax, which depends on the code generated, with
+ *  or without -O, so the interpreter does not try to match it.
+ *
+ */
+
+#define vmHotLoop 1000 //Trips round a loop before --tiered hands it to the machine code tier
+
+//Instructions
+//  Registers are the variables, numbered by symbol ID, then the temporaries.
+//  The ...K forms take the constant c in place of register c.
+enum {
+	VM_HALT,
+	VM_MOV, //a = b
+	VM_LOADK, //a = c
+	VM_ADD, VM_SUB, VM_MUL, VM_DIV, VM_AND, VM_OR, VM_XOR, //a = b op c
+	VM_ADDK, VM_SUBK, VM_MULK, VM_DIVK, VM_ANDK, VM_ORK, VM_XORK,
+	VM_KSUB, VM_KDIV, //a = c op b, for a constant on the left
+	VM_NEG, VM_NOT, //a = op b
+	VM_EQ, VM_NE, VM_LT, VM_GE, VM_LE, VM_GT, //a = b rel c, TRUE or FALSE
+	VM_EQK, VM_NEK, VM_LTK, VM_GEK, VM_LEK, VM_GTK,
+	VM_JMP, //Jump to c
+	VM_JZ, VM_JNZ, //Jump to c if a is zero, or not
+	VM_BEQ, VM_BNE, VM_BLT, VM_BGE, VM_BLE, VM_BGT, //Jump to c if a rel b
+	VM_BEQK, VM_BNEK, VM_BLTK, VM_BGEK, VM_BLEK, VM_BGTK, //Jump to c if a rel constant b
+	VM_LOOP, //Count a trip round loop a, which ends at c, for --tiered
+	VM_READ, //READ a
+	VM_WRITE, //WRITE a
+	vmOpCount
+};
+
+typedef struct {
+	int op;
+	int a;
+	int b;
+	int c;
+} VmInstr;
+
+//An operand while compiling: a register, or a constant
+typedef struct {
+	int isConst;
+	int v;
+} VmValue;
+
+//Run loop number loop, the WHILE statement node, to its end in another tier
+//  regs holds the variables on the way in and out
+//  Returns 0 if it did, or -1 to go on interpreting
+typedef int VmHotLoop(void *ctx, int loop, int node, int *regs);
+
+typedef struct {
+	VmInstr *code;
+	int count;
+	int capacity;
+	int *init; //Starting value of each register
+	int regCount;
+	int regCapacity;
+	int varCount; //Registers below this are variables
+	int *labelAt; //Instruction each label is at
+	int labelCount;
+	int labelCapacity;
+	int *work; //Expression walk stack
+	VmValue *vals; //Operands of the expression being compiled
+	int stackCapacity;
+	int *loopNode; //WHILE statement of each VM_LOOP
+	int loopCount;
+	int loopCapacity;
+	VmHotLoop *hot; //Where hot loops go, or NULL for no VM_LOOP at all
+	void *hotCtx;
+} Vm;
+
+void vmVar(Vm *vm, int id, int value);
+void vmCompile(Vm *vm, const Ast *t, int body, int symCount);
+int vmRun(const Vm *vm, int *status);
+void freeVm(Vm *vm);